@@ -7,6 +7,7 @@
 
 #include <cstdlib>
 #include <limits>
+#include <typeinfo>
 #include <cstdint>
 #include <sys/stat.h>
 
@@ -37,10 +38,11 @@ struct Record {
     }
 };
 
-enum OperationType {READ = 0, INSERT, UPDATE, DELETE};
+enum OperationType {READ = 0, INSERT, UPDATE, DELETE, SCAN, RMW};
 
-struct QueryType {
+struct QueryType { // 16 bytes, also the record of binary workload files
     OperationType op;
+    int32_t len; // the number of records to scan, only for SCAN
     int64_t key;
 };
 
@@ -0,0 +1,354 @@
+#ifndef __SHARDED_TLBTREE_H__
+#define __SHARDED_TLBTREE_H__
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+
+#include "tlbtree.h"
+#include "../src/numa.h"
+
+struct shard_config_t {
+    std::string path;   // the pool file of the shard
+    int numa_node;      // the node its pool is opened on and its workers run on, -1 for any
+    shard_config_t(std::string p, int node = -1): path(p), numa_node(node) {}
+};
+
+/*
+    ShardedTLBtree:
+        partitions the key space across independent TLBtreeImpl instances, each with its own
+        pool, allocator, mutable_ and rebuild latch, so writers of different shards share none
+        of them. Shard i holds the keys in [splits[i - 1], splits[i]), the split-key table is
+        persisted beside the pool of shard 0 (<path>.splits) and replaced by a rename.
+        Point operations binary search the table and run on the calling thread. Batch operations
+        and range scans fan out, one worker per shard on the node of the shard; the rebuilds
+        they launch inherit its CPUs.
+        rebalance() moves records between shards without latches: call it, like footprint(),
+        without concurrent operations.
+*/
+class ShardedTLBtree {
+public:
+    typedef TLBtreeImpl<2, 2> ShardType;
+
+    // splits are only used for new trees, by default the shards split [0, MAX_KEY) evenly
+    ShardedTLBtree(const std::vector<shard_config_t> & shards, std::vector<_key_t> splits = {}, uint64_t poolsize = POOL_SIZE)
+        : configs_(shards), table_path_(shards.at(0).path + ".splits") {
+        int n = shards.size();
+        if(!load_splits()) {
+            if(splits.empty()) {
+                for(int i = 1; i < n; i++)
+                    splits.push_back(MAX_KEY / n * i);
+            }
+            assert(valid_splits(splits));
+            splits_ = splits;
+            save_splits();
+        }
+        assert((int)splits_.size() == n - 1);
+
+        trees_.assign(n, NULL);
+        fan_out(all_shards(), [&](int s) {
+            const char * path = configs_[s].path.c_str();
+            trees_[s] = new ShardType(path, file_exist(path), poolsize);
+        });
+        purge_strays(); // the leftovers of an interrupted rebalance
+    }
+
+    ~ShardedTLBtree() {
+        for(auto t : trees_)
+            delete t;
+    }
+
+    ShardedTLBtree(const ShardedTLBtree &) = delete;
+    ShardedTLBtree & operator = (const ShardedTLBtree &) = delete;
+
+    inline int shard_cnt() const { return trees_.size(); }
+
+    inline int shard_of(_key_t key) const {
+        return std::upper_bound(splits_.begin(), splits_.end(), key) - splits_.begin();
+    }
+
+    inline int shard_node(int s) const { return configs_[s].numa_node; }
+
+    inline const std::vector<_key_t> & splits() const { return splits_; }
+
+    inline ShardType * shard(int s) { return trees_[s]; }
+
+    inline void insert(_key_t key, uint64_t val) {
+        trees_[shard_of(key)]->insert(key, val);
+    }
+
+    inline bool update(_key_t key, uint64_t val) {
+        return trees_[shard_of(key)]->update(key, val);
+    }
+
+    inline uint64_t lookup(_key_t key) {
+        uint64_t val;
+        bool found = trees_[shard_of(key)]->find(key, val);
+
+        if(found)
+            return val;
+        else
+            return 0;
+    }
+
+    inline bool remove(_key_t key) {
+        return trees_[shard_of(key)]->remove(key);
+    }
+
+    int scan(_key_t start, int len, Record * out) {
+        // a scan that runs off the end of a shard goes on from the first key of the next one
+        int cnt = 0;
+        for(int s = shard_of(start); s < shard_cnt() && cnt < len; s++) {
+            _key_t from = std::max(start, lower(s));
+            int got = trees_[s]->scan(from, len - cnt, out + cnt);
+            cnt += std::lower_bound(out + cnt, out + cnt + got, Record(upper(s))) - (out + cnt);
+        }
+        return cnt;
+    }
+
+    size_t scan_range(_key_t lo, _key_t hi, std::vector<Record> & out) {
+        // append the records in [lo, hi) to out, the shards overlapping it are scanned in parallel
+        if(hi <= lo) return 0;
+        int first = shard_of(lo);
+        int last = std::lower_bound(splits_.begin(), splits_.end(), hi) - splits_.begin();
+
+        std::vector<int> ids;
+        for(int s = first; s <= last; s++)
+            ids.push_back(s);
+        std::vector<std::vector<Record>> parts(shard_cnt());
+        fan_out(ids, [&](int s) {
+            walk(s, std::max(lo, lower(s)), std::min(hi, upper(s)), [&](const Record & r) { parts[s].push_back(r); });
+        });
+
+        size_t cnt = 0;
+        for(int s : ids) {
+            out.insert(out.end(), parts[s].begin(), parts[s].end());
+            cnt += parts[s].size();
+        }
+        return cnt;
+    }
+
+    void lookup_batch(const std::vector<_key_t> & keys, std::vector<uint64_t> & vals) {
+        // vals[i] is the value of keys[i], 0 if it is not found
+        vals.assign(keys.size(), 0);
+        std::vector<std::vector<size_t>> idx(shard_cnt());
+        for(size_t i = 0; i < keys.size(); i++)
+            idx[shard_of(keys[i])].push_back(i);
+
+        fan_out(busy_shards(idx), [&](int s) {
+            for(size_t i : idx[s]) {
+                uint64_t val;
+                if(trees_[s]->find(keys[i], val))
+                    vals[i] = val;
+            }
+        });
+    }
+
+    void ingest(std::vector<Record> & batch, int thread_cnt = std::thread::hardware_concurrency()) {
+        // each shard ingests its part of the batch with its share of thread_cnt
+        std::vector<std::vector<Record>> parts(shard_cnt());
+        for(auto & r : batch)
+            parts[shard_of(r.key)].push_back(r);
+
+        std::vector<int> ids = busy_shards(parts);
+        int per_shard = std::max(1, thread_cnt / std::max(1, (int)ids.size()));
+        fan_out(ids, [&](int s) { trees_[s]->ingest(parts[s], per_shard); });
+    }
+
+    void rebalance(const std::vector<_key_t> & splits) {
+        /* move the records whose shard changes: they are copied to their new shards, the table
+            is switched, then they are removed from their old shards. A crash in between leaves
+            copies outside the range of a shard, which no operation routes to, and which the
+            next open purges */
+        assert((int)splits.size() == shard_cnt() - 1 && valid_splits(splits));
+        int n = shard_cnt();
+
+        struct move_t {
+            int src, dst;
+            _key_t lo, hi;
+            std::vector<Record> recs;
+        };
+        std::vector<move_t> moves;
+        for(int src = 0; src < n; src++) {
+            for(int dst = 0; dst < n; dst++) {
+                if(src == dst) continue;
+                _key_t lo = std::max(lower(src), dst == 0 ? MIN_KEY : splits[dst - 1]);
+                _key_t hi = std::min(upper(src), dst == n - 1 ? MAX_KEY : splits[dst]);
+                if(lo < hi) moves.push_back({src, dst, lo, hi, {}});
+            }
+        }
+
+        fan_out(all_shards(), [&](int s) {
+            for(auto & m : moves) {
+                if(m.src == s)
+                    walk(s, m.lo, m.hi, [&](const Record & r) { m.recs.push_back(r); });
+            }
+        });
+        fan_out(all_shards(), [&](int s) {
+            std::vector<Record> in;
+            for(auto & m : moves) {
+                if(m.dst == s) in.insert(in.end(), m.recs.begin(), m.recs.end());
+            }
+            trees_[s]->ingest(in, 1);
+        });
+
+        splits_ = splits;
+        save_splits();
+
+        fan_out(all_shards(), [&](int s) {
+            for(auto & m : moves) {
+                if(m.src != s) continue;
+                for(auto & r : m.recs)
+                    trees_[s]->remove(r.key);
+            }
+        });
+    }
+
+    std::vector<_key_t> even_splits() {
+        // the split keys that give every shard the same number of records, walks all of them
+        int n = shard_cnt();
+        std::vector<size_t> cnts(n, 0);
+        fan_out(all_shards(), [&](int s) {
+            walk(s, lower(s), upper(s), [&](const Record &) { cnts[s]++; });
+        });
+        size_t total = 0;
+        for(auto c : cnts) total += c;
+        if(total < (size_t)n) return splits_;
+
+        std::vector<_key_t> splits;
+        size_t seen = 0;
+        for(int s = 0; s < n && (int)splits.size() < n - 1; s++) {
+            if(seen + cnts[s] <= total * (splits.size() + 1) / n) { // no split falls in this shard
+                seen += cnts[s];
+                continue;
+            }
+            walk(s, lower(s), upper(s), [&](const Record & r) {
+                if((int)splits.size() < n - 1 && seen == total * (splits.size() + 1) / n)
+                    splits.push_back(r.key);
+                seen++;
+            });
+        }
+        return splits;
+    }
+
+    // the counters of shard s alone, counted since it was opened; the shards do not share any
+    inline tlbtree_stats_t stats(int s) {
+        return trees_[s]->stats();
+    }
+
+    inline tlbtree_footprint_t footprint(int s) {
+        return trees_[s]->footprint();
+    }
+
+private:
+    std::vector<shard_config_t> configs_;
+    std::vector<ShardType *> trees_;
+    std::vector<_key_t> splits_;   // shard_cnt() - 1 ascending split keys
+    std::string table_path_;
+
+    inline _key_t lower(int s) const { return s == 0 ? MIN_KEY : splits_[s - 1]; }
+
+    inline _key_t upper(int s) const { return s == (int)splits_.size() ? MAX_KEY : splits_[s]; }
+
+    static bool valid_splits(const std::vector<_key_t> & splits) {
+        return std::is_sorted(splits.begin(), splits.end());
+    }
+
+    std::vector<int> all_shards() const {
+        std::vector<int> ids(shard_cnt());
+        for(int s = 0; s < shard_cnt(); s++)
+            ids[s] = s;
+        return ids;
+    }
+
+    template<typename T>
+    static std::vector<int> busy_shards(const std::vector<std::vector<T>> & parts) {
+        std::vector<int> ids;
+        for(size_t s = 0; s < parts.size(); s++)
+            if(!parts[s].empty()) ids.push_back(s);
+        return ids;
+    }
+
+    template<typename F>
+    void fan_out(const std::vector<int> & ids, F fn) {
+        // run fn(s) for every shard s of ids, each by a worker pinned to the node of the shard
+        if(ids.size() == 1 && configs_[ids[0]].numa_node < 0) {
+            fn(ids[0]);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for(int s : ids) {
+            workers.emplace_back([this, s, &fn]() {
+                numa::pin(configs_[s].numa_node);
+                fn(s);
+            });
+        }
+        for(auto & w : workers)
+            w.join();
+    }
+
+    template<typename F>
+    void walk(int s, _key_t from, _key_t to, F fn) {
+        // call fn on every record of shard s in [from, to), in key order
+        static const int CHUNK = 256;
+        Record buf[CHUNK];
+        bool first = true;
+        while(from < to) {
+            int got = trees_[s]->scan(from, CHUNK, buf);
+            int i = 0;
+            while(!first && i < got && buf[i].key <= from) // the chunks after the first start at the last key seen
+                i++;
+            for(; i < got && buf[i].key < to; i++)
+                fn(buf[i]);
+            if(i < got || got < CHUNK) break;
+            from = buf[got - 1].key;
+            first = false;
+        }
+    }
+
+    void purge_strays() {
+        // remove the records of each shard outside its range
+        fan_out(all_shards(), [&](int s) {
+            std::vector<_key_t> strays;
+            auto add = [&](const Record & r) { strays.push_back(r.key); };
+            if(s > 0) walk(s, MIN_KEY, lower(s), add);
+            if(s < shard_cnt() - 1) walk(s, upper(s), MAX_KEY, add);
+            for(auto k : strays)
+                trees_[s]->remove(k);
+        });
+    }
+
+    bool load_splits() {
+        FILE * fp = fopen(table_path_.c_str(), "rb");
+        if(fp == NULL) return false;
+        uint64_t cnt = 0;
+        bool ok = fread(&cnt, sizeof(cnt), 1, fp) == 1;
+        if(ok) {
+            splits_.resize(cnt);
+            ok = fread(splits_.data(), sizeof(_key_t), cnt, fp) == cnt;
+        }
+        fclose(fp);
+        assert(ok);
+        return ok;
+    }
+
+    void save_splits() {
+        // write a new table aside, then rename it over the old one
+        std::string tmp = table_path_ + ".tmp";
+        FILE * fp = fopen(tmp.c_str(), "wb");
+        assert(fp != NULL);
+        uint64_t cnt = splits_.size();
+        fwrite(&cnt, sizeof(cnt), 1, fp);
+        fwrite(splits_.data(), sizeof(_key_t), cnt, fp);
+        fflush(fp);
+        fsync(fileno(fp));
+        fclose(fp);
+        rename(tmp.c_str(), table_path_.c_str());
+    }
+};
+
+#endif //__SHARDED_TLBTREE_H__
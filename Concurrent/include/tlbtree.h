@@ -4,6 +4,8 @@
 #include "../src/tlbtree_impl.h"
 
 using tlbtree::TLBtreeImpl;
+using tlbtree::tlbtree_stats_t;
+using tlbtree::tlbtree_footprint_t;
 
 // configure the PMEM file and file size
 static constexpr uint64_t POOL_SIZE = 512UL * 1024 * 1024;
@@ -15,6 +17,12 @@ public:
         tree_ = new TLBtreeImpl<2,2>(tlbname, recover, poolsize);
     }
 
+    // one pool file per NUMA node, poolnames[i] on node i, each of poolsize
+    TLBtree(std::vector<std::string> poolnames, uint64_t poolsize = POOL_SIZE) {
+        bool recover = file_exist(poolnames[0].c_str());
+        tree_ = new TLBtreeImpl<2,2>(poolnames, recover, poolsize);
+    }
+
     ~TLBtree() {
         delete tree_;
     }
@@ -41,6 +49,27 @@ public:
         return tree_->remove(key);
     }
 
+    inline int scan(_key_t start, int len, Record * out) {
+        return tree_->scan(start, len, out);
+    }
+
+    inline tlbtree_stats_t stats() {
+        return tree_->stats();
+    }
+
+    inline tlbtree_footprint_t footprint() {
+        return tree_->footprint();
+    }
+
+    // the footprint of a tree that is not open, read from its pool files without writing them
+    static inline tlbtree_footprint_t footprint(std::vector<std::string> poolnames) {
+        return TLBtreeImpl<2,2>::footprint(poolnames);
+    }
+
+    inline void ingest(std::vector<Record> & batch, int thread_cnt = std::thread::hardware_concurrency()) {
+        tree_->ingest(batch, thread_cnt);
+    }
+
 private:
     TLBtreeImpl <2,2> * tree_;
 };
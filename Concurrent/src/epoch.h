@@ -0,0 +1,201 @@
+/*  epoch.h - epoch based reclamation of nodes unlinked from TLBtree
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <thread>
+
+#include "spinlock.h"
+
+/*
+    EpochManager:
+        every operation runs in a critical section, announcing the global epoch it started in.
+        A writer that unlinks a node retires it with the epoch of the moment; the node is
+        reclaimed once the global epoch is two ahead, when every operation that could have
+        seen it has finished. The global epoch advances when all the threads in a critical
+        section have announced the current epoch, which is checked every RETIRE_BATCH retires
+        of a thread, or on an explicit collect() after retiring something large.
+        Each thread owns a cache-line aligned slot, released when the thread exits; the nodes
+        it retired stay in the slot until a collect() of any thread reclaims them.
+*/
+class EpochManager {
+private:
+    static const int SLOTS = 1024;
+    static const uint64_t QUIESCENT = UINT64_MAX;
+    static const int RETIRE_BATCH = 64;
+
+    struct retired_t {
+        uint64_t epoch;
+        std::function<void()> reclaim;
+    };
+
+    struct slot_t {
+        std::atomic<uint64_t> local;   // the announced epoch, QUIESCENT out of critical sections
+        std::atomic<bool> used;
+        Spinlock mtx;                  // guards retired, against collect() and synchronize() of other threads
+        std::vector<retired_t> retired;
+    } __attribute__((aligned(64)));
+
+    struct handle_t { // the slot of this thread
+        EpochManager * mgr = NULL;
+        int idx = -1;
+        int depth = 0;                 // nested critical sections
+        uint32_t retires = 0;
+        ~handle_t() { if(mgr != NULL) mgr->release(idx); }
+    };
+
+    std::atomic<uint64_t> global_;
+    slot_t * slots_;
+    std::atomic<int> high_;            // slots ever used
+
+public:
+    EpochManager(): global_(0), slots_(new slot_t[SLOTS]), high_(0) {
+        for(int i = 0; i < SLOTS; i++) {
+            slots_[i].local.store(QUIESCENT, std::memory_order_relaxed);
+            slots_[i].used.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    ~EpochManager() { // no thread is left in a critical section
+        for(int i = 0; i < high_.load(std::memory_order_relaxed); i++) {
+            for(auto & r : slots_[i].retired) r.reclaim();
+        }
+        delete [] slots_;
+    }
+
+    EpochManager(const EpochManager &) = delete;
+    EpochManager & operator = (const EpochManager &) = delete;
+
+public:
+    inline void enter() {
+        handle_t & h = handle();
+        if(h.depth++ > 0) return;
+        // the announcement must be visible before any shared node is read
+        slots_[h.idx].local.store(global_.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+    }
+
+    inline void exit() {
+        handle_t & h = handle();
+        if(--h.depth > 0) return;
+        slots_[h.idx].local.store(QUIESCENT, std::memory_order_release);
+    }
+
+    void retire(std::function<void()> reclaim) { // reclaim runs when no operation can reach the node
+        handle_t & h = handle();
+        std::atomic_thread_fence(std::memory_order_seq_cst); // the unlinking is ordered before reading the epoch
+        slot_t & s = slots_[h.idx];
+        s.mtx.lock();
+            s.retired.push_back({global_.load(std::memory_order_relaxed), std::move(reclaim)});
+        s.mtx.unlock();
+
+        if(++h.retires % RETIRE_BATCH == 0) collect();
+    }
+
+    void collect() { // advance the epoch if possible, and reclaim what is safe in all the slots
+        try_advance();
+        uint64_t safe = global_.load(std::memory_order_acquire);
+        int high = high_.load(std::memory_order_acquire);
+        for(int i = 0; i < high; i++)
+            collect_slot(slots_[i], safe);
+    }
+
+    uint64_t barrier() {
+        /* wait for the operations in flight to finish, those starting later can not reach what
+            was unlinked before the call. The caller must not be in a critical section */
+        uint64_t target = global_.load(std::memory_order_acquire) + 2;
+        while(global_.load(std::memory_order_acquire) < target) {
+            if(!try_advance()) std::this_thread::yield();
+        }
+        return target;
+    }
+
+    void synchronize() {
+        // reclaim all that is retired so far, the caller must not be in a critical section
+        uint64_t target = barrier();
+        int high = high_.load(std::memory_order_acquire);
+        for(int i = 0; i < high; i++)
+            collect_slot(slots_[i], target, true);
+    }
+
+    uint64_t pending() const { // retired nodes not reclaimed yet, racy
+        uint64_t cnt = 0;
+        int high = high_.load(std::memory_order_acquire);
+        for(int i = 0; i < high; i++)
+            cnt += slots_[i].retired.size();
+        return cnt;
+    }
+
+private:
+    handle_t & handle() {
+        static thread_local handle_t h;
+        if(h.idx < 0) {
+            h.idx = acquire();
+            h.mgr = this;
+        }
+        return h;
+    }
+
+    int acquire() {
+        while(true) {
+            for(int i = 0; i < SLOTS; i++) {
+                bool expected = false;
+                if(!slots_[i].used.load(std::memory_order_relaxed)
+                    && slots_[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    int high = high_.load(std::memory_order_relaxed);
+                    while(high < i + 1 && !high_.compare_exchange_weak(high, i + 1, std::memory_order_release));
+                    return i;
+                }
+            }
+            std::this_thread::yield(); // all the slots are taken, wait for an exiting thread
+        }
+    }
+
+    void release(int idx) { // the retired list stays, any collect() reclaims it
+        slots_[idx].local.store(QUIESCENT, std::memory_order_release);
+        slots_[idx].used.store(false, std::memory_order_release);
+    }
+
+    bool try_advance() {
+        uint64_t e = global_.load(std::memory_order_acquire);
+        int high = high_.load(std::memory_order_acquire);
+        for(int i = 0; i < high; i++) {
+            uint64_t l = slots_[i].local.load(std::memory_order_acquire);
+            if(l != QUIESCENT && l != e) return false;
+        }
+        return global_.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel);
+    }
+
+    void collect_slot(slot_t & s, uint64_t safe, bool wait = false) {
+        std::vector<retired_t> ready;
+        if(wait) s.mtx.lock();
+        else if(!s.mtx.trylock()) return; // the owner is retiring, collect it next time
+            size_t j = 0;
+            for(size_t i = 0; i < s.retired.size(); i++) {
+                if(s.retired[i].epoch + 2 <= safe)
+                    ready.push_back(std::move(s.retired[i]));
+                else
+                    s.retired[j++] = std::move(s.retired[i]);
+            }
+            s.retired.resize(j);
+        s.mtx.unlock();
+
+        for(auto & r : ready) r.reclaim();
+    }
+};
+
+// the epochs of all TLBtree instances, defined in tlbtree_impl.cc
+extern EpochManager gepoch;
+
+struct epoch_guard_t { // a critical section of one operation
+    epoch_guard_t() { gepoch.enter(); }
+    ~epoch_guard_t() { gepoch.exit(); }
+};
+
+#endif // __EPOCH_H__
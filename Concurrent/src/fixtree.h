@@ -12,14 +12,17 @@
 #include <vector>
 #include <cassert>
 #include <cstring>
+#include <atomic>
 
 #include "flush.h"
 #include "pmallocator.h"
+#include "stats.h"
 
 namespace fixtree {
     const int INNER_CARD = 32; // node size: 256B, the fanout of inner node is 32
     const int LEAF_CARD = 15;  // node size: 256B, the fanout of leaf node is 16
     const int LEAF_REBUILD_CARD = 8;
+    const int LEAF_SPARSE = LEAF_REBUILD_CARD / 2; // a leaf with fewer live slots is sparse, a rebuild fills it to LEAF_REBUILD_CARD
     const int MAX_HEIGHT = 10;
 
     // the entrance of fixtree that stores its persistent tree metadata
@@ -34,6 +37,8 @@ namespace fixtree {
         a search-optimized linearize tree structure which can absort moderate insertions: 
 */
 class Fixtree {
+    friend struct fixtree_bench; // test/microbench.cc times the searches in isolation
+
     public:
         struct INNode { // inner node is packed keys, which is very compact
             _key_t keys[INNER_CARD];
@@ -54,12 +59,16 @@ class Fixtree {
         uint32_t height_;
         uint32_t leaf_cnt_;
         entrance_t * entrance_;
+        PMAllocator * alc_;               // the pool of the nodes and of the entrance
         uint32_t level_offset_[MAX_HEIGHT];
+        std::atomic<uint32_t> live_cnt_; // occupied leaf slots, the sub-index roots still routed to
+        std::vector<uint8_t> leaf_live_; // occupied slots of each leaf, updated under the leaf latch
+        std::atomic<uint32_t> sparse_cnt_; // leaves with less than LEAF_SPARSE occupied slots
     
     public:
-        Fixtree(entrance_t * ent) { // recovery the tree from the entrance
-            inner_nodes_ = (INNode *)galc->absolute(ent->inner_buff);
-            leaf_nodes_ = (LFNode *)galc->absolute(ent->leaf_buff);
+        Fixtree(PMAllocator * alc, entrance_t * ent): alc_(alc) { // recovery the tree from the entrance
+            inner_nodes_ = (INNode *)alc_->absolute(ent->inner_buff);
+            leaf_nodes_ = (LFNode *)alc_->absolute(ent->leaf_buff);
             height_ = ent->height;
             leaf_cnt_ = ent->leaf_cnt;
             entrance_ = ent;
@@ -70,30 +79,35 @@ class Fixtree {
                 tmp += std::pow(INNER_CARD, l);
             }
             level_offset_[height_] = tmp;
+
+            count_live();
         }
 
-        Fixtree(std::vector<Record> records) {
+        Fixtree(PMAllocator * alc, std::vector<Record> records): alc_(alc) {
             const int lfary = LEAF_REBUILD_CARD;
             int record_count = records.size();
             
             uint32_t lfnode_cnt = std::ceil((float)record_count / lfary);
-            leaf_nodes_ = (LFNode *) galc->malloc(std::max((size_t)4096, lfnode_cnt * sizeof(LFNode)));
+            leaf_nodes_ = (LFNode *) alc_->malloc(std::max((size_t)4096, lfnode_cnt * sizeof(LFNode)));
 
             height_ = std::ceil(std::log(std::max((uint32_t)INNER_CARD, lfnode_cnt)) / std::log(INNER_CARD));
             uint32_t innode_cnt = (std::pow(INNER_CARD, height_) - 1) / (INNER_CARD - 1);
-            inner_nodes_ = (INNode *) galc->malloc(std::max((size_t)4096, innode_cnt * sizeof(INNode)));
+            inner_nodes_ = (INNode *) alc_->malloc(std::max((size_t)4096, innode_cnt * sizeof(INNode)));
 
             // fill leaf nodes
             for(int i = 0; i < lfnode_cnt; i++) {
+                LFNode img;
+                img.node_version = 0;
                 for(int j = 0; j < lfary; j++) {
                     auto idx = i * lfary + j;
-                    leaf_nodes_[i].keys[j] = idx < record_count ? records[idx].key : MAX_KEY; 
-                    leaf_nodes_[i].vals[j] = idx < record_count ? records[idx].val : 0;
+                    img.keys[j] = idx < record_count ? records[idx].key : MAX_KEY; 
+                    img.vals[j] = idx < record_count ? records[idx].val : 0;
                 }
                 for(int j = lfary; j < LEAF_CARD; j++) { // intialized key
-                    leaf_nodes_[i].keys[j] = MAX_KEY;
+                    img.keys[j] = MAX_KEY;
+                    img.vals[j] = 0;
                 }
-                clwb(leaf_nodes_ + i, sizeof(LFNode));
+                persist_copy(leaf_nodes_ + i, &img, sizeof(LFNode));
             }
             
             int cur_level_cnt = lfnode_cnt;
@@ -101,11 +115,7 @@ class Fixtree {
             int last_level_off = 0;
             
             // fill parent innodes of leaf nodes
-            for(int i = 0; i < cur_level_cnt; i++)
-                inner_insert(cur_level_off + i / INNER_CARD, i % INNER_CARD, leaf_nodes_[i].keys[0]);
-            if(cur_level_cnt % INNER_CARD)
-                inner_insert(cur_level_off + cur_level_cnt / INNER_CARD, cur_level_cnt % INNER_CARD, MAX_KEY);
-            clwb(&inner_nodes_[cur_level_off], sizeof(INNode) * (cur_level_cnt / INNER_CARD + 1));
+            inner_fill(cur_level_off, cur_level_cnt, [&](int i) { return records[i * lfary].key; });
             
             cur_level_cnt = std::ceil((float)cur_level_cnt / INNER_CARD);
             last_level_off = cur_level_off;
@@ -113,19 +123,17 @@ class Fixtree {
 
             // fill other inner nodes
             for(int l = height_ - 2; l >= 0; l--) { // level by level
-                for(int i = 0; i < cur_level_cnt; i++)
-                    inner_insert(cur_level_off + i / INNER_CARD, i % INNER_CARD, inner_nodes_[last_level_off + i].keys[0]);
-                if(cur_level_cnt % INNER_CARD)
-                    inner_insert(cur_level_off + cur_level_cnt / INNER_CARD, cur_level_cnt % INNER_CARD, MAX_KEY);
-                clwb(&inner_nodes_[cur_level_off], sizeof(INNode) * (cur_level_cnt / INNER_CARD + 1));
+                inner_fill(cur_level_off, cur_level_cnt, [&](int i) { return inner_nodes_[last_level_off + i].keys[0]; });
 
                 cur_level_cnt = std::ceil((float)cur_level_cnt / INNER_CARD);
                 last_level_off = cur_level_off;
                 cur_level_off = cur_level_off - std::pow(INNER_CARD, l - 1);
             }
+            mfence(); // all the nodes are persisted before they are published in entrance_
             
             leaf_cnt_ = lfnode_cnt;
-            entrance_ = (entrance_t *)galc->malloc(4096); // the allocator is not thread_safe, allocate a large entrance
+            count_live();
+            entrance_ = (entrance_t *)alc_->malloc(4096); // the allocator is not thread_safe, allocate a large entrance
             uint32_t tmp = 0;
             for(int l = 0; l < height_; l++) {
                 level_offset_[l] = tmp;
@@ -133,8 +141,8 @@ class Fixtree {
             }
             level_offset_[height_] = tmp;
 
-            persist_assign(&(entrance_->leaf_buff), (void *) galc->relative(leaf_nodes_));
-            persist_assign(&(entrance_->inner_buff), (void *) galc->relative(inner_nodes_));
+            persist_assign(&(entrance_->leaf_buff), (void *) alc_->relative(leaf_nodes_));
+            persist_assign(&(entrance_->inner_buff), (void *) alc_->relative(inner_nodes_));
             persist_assign(&(entrance_->height), height_);
             persist_assign(&(entrance_->leaf_cnt), lfnode_cnt);
 
@@ -167,20 +175,28 @@ class Fixtree {
             cur_idx -= level_offset_[height_];
             
             LFNode * cur_leaf = leaf_nodes_ + cur_idx;
+            pmemu_read(cur_leaf, sizeof(LFNode));
 
             for(int i = 0; i < LEAF_CARD; i++) {
                 if (cur_leaf->keys[i] == MAX_KEY) { // empty slot
                     cur_leaf->mtx.lock();
+                    if(cur_leaf->keys[i] != MAX_KEY) { // taken by another thread meanwhile
+                        cur_leaf->mtx.unlock();
+                        continue;
+                    }
                         leaf_insert(cur_idx, i, {key, (char *)val});
                     cur_leaf->node_version++;
+                    if(++leaf_live_[cur_idx] == LEAF_SPARSE)
+                        sparse_cnt_.fetch_sub(1, std::memory_order_relaxed);
                     cur_leaf->mtx.unlock();
+                    live_cnt_.fetch_add(1, std::memory_order_relaxed);
                     return true;
                 }
             }
             return false;
         }
 
-        bool try_remove(_key_t key) {
+        bool try_remove(_key_t key, const char * val) { // remove the slot of sub-index root val, which covers key
             int cur_idx = level_offset_[0];
             for(int l = 0; l < height_; l++) {
                 #ifdef DEBUG
@@ -191,6 +207,7 @@ class Fixtree {
             cur_idx -= level_offset_[height_];
             
             LFNode * cur_leaf = leaf_nodes_ + cur_idx;
+            pmemu_read(cur_leaf, sizeof(LFNode));
 
             cur_leaf->mtx.lock();
 
@@ -212,14 +229,20 @@ class Fixtree {
                   2. | k1 | ---      |, delete k1, leaf is empty if k1 is deleted (success)
                   3. | k1 | --- | kx |, delete kx, leaf is not empty if kx is deleted (success)
             */
-            if(max_leqi == 0 && rec_cnt > 1) { // case 1
+            if(cur_leaf->keys[max_leqi] == MAX_KEY || cur_leaf->vals[max_leqi] != val) { // routed by another slot
+                cur_leaf->mtx.unlock();
+                return false;
+            } else if(max_leqi == 0 && rec_cnt > 1) { // case 1
                 cur_leaf->mtx.unlock();
                 return false;
             } else { // case 2, 3
                 persist_assign(&(cur_leaf->keys[max_leqi]), MAX_KEY);
                 
                 cur_leaf->node_version++;
+                if(leaf_live_[cur_idx]-- == LEAF_SPARSE)
+                    sparse_cnt_.fetch_add(1, std::memory_order_relaxed);
                 cur_leaf->mtx.unlock();
+                live_cnt_.fetch_sub(1, std::memory_order_relaxed);
                 return true;
             }
         }
@@ -241,6 +264,19 @@ class Fixtree {
             }
         }
 
+        double leaf_fill() const { // the fraction of occupied slots in leaf nodes
+            uint64_t used = 0;
+            for(int i = 0; i < leaf_cnt_; i++) {
+                for(int j = 0; j < LEAF_CARD; j++)
+                    used += (leaf_nodes_[i].keys[j] != MAX_KEY);
+            }
+            return (double)used / ((uint64_t)leaf_cnt_ * LEAF_CARD);
+        }
+
+        uint32_t inner_cnt() const { // the inner nodes allocated for a complete tree of height_
+            return level_offset_[height_];
+        }
+
         char ** find_first() {
             return (char **)&(leaf_nodes_[0].vals[0]);
         }
@@ -251,7 +287,8 @@ class Fixtree {
             uint32_t incur = 0, innode_pos = 0, cur_lfcnt = 0;
             Record tmp[LEAF_CARD];
             load_node(tmp, &leaf_nodes_[0]);
-            _key_t k1 = in[0].key, k2 = tmp[0].key;
+            auto in_key = [&](uint32_t i) { return i < insize ? in[i].key : MAX_KEY; }; // in may be empty
+            _key_t k1 = in_key(0), k2 = tmp[0].key;
             while(incur < insize && cur_lfcnt < leaf_cnt_) {
                 if(k1 == k2) { 
                     out.push_back(in[incur]);
@@ -264,7 +301,7 @@ class Fixtree {
                         innode_pos = 0;
                     }
 
-                    k1 = in[incur].key;
+                    k1 = in_key(incur);
                     k2 = tmp[innode_pos].key;
                 } else if(k1 > k2) {
                     out.push_back(tmp[innode_pos]);
@@ -281,7 +318,7 @@ class Fixtree {
                     out.push_back(in[incur]);
                     
                     incur += 1;
-                    k1 = in[incur].key;
+                    k1 = in_key(incur);
                 }
             }
 
@@ -305,8 +342,22 @@ class Fixtree {
         }
 
     private:
+        void count_live() { // count the occupied slots of every leaf, and the sparse leaves
+            uint32_t live = 0, sparse = 0;
+            leaf_live_.assign(leaf_cnt_, 0);
+            for(int i = 0; i < leaf_cnt_; i++) {
+                for(int j = 0; j < LEAF_CARD; j++)
+                    leaf_live_[i] += (leaf_nodes_[i].keys[j] != MAX_KEY);
+                live += leaf_live_[i];
+                sparse += leaf_live_[i] < LEAF_SPARSE;
+            }
+            live_cnt_ = live;
+            sparse_cnt_ = sparse;
+        }
+
         int inner_search(int node_idx, _key_t key) const{
             INNode * cur_inner = inner_nodes_ + node_idx;
+            pmemu_read(cur_inner, sizeof(INNode));
             for(int i = 0; i < INNER_CARD; i++) {
                 if (cur_inner->keys[i] > key) {
                     return i - 1;
@@ -318,6 +369,7 @@ class Fixtree {
         
         char **leaf_search(int node_idx, _key_t key) const {
             LFNode * cur_leaf = leaf_nodes_ + node_idx;
+            pmemu_read(cur_leaf, sizeof(LFNode));
 
             retry:
             auto old_version = cur_leaf->node_version;
@@ -331,7 +383,10 @@ class Fixtree {
                 }
             }
 
-            if (old_version != cur_leaf->node_version) goto retry;
+            if (old_version != cur_leaf->node_version) {
+                stat_add(stats::OLC_RETRY_LEAF);
+                goto retry;
+            }
             
             return (char **) &(cur_leaf->vals[max_leqi]);
         }
@@ -346,8 +401,17 @@ class Fixtree {
             mfence();
         }
 
-        inline void inner_insert(int node_idx, int off, _key_t key) {
-            inner_nodes_[node_idx].keys[off] = key;
+        template<typename F>
+        void inner_fill(int level_off, int child_cnt, F child_key) { 
+            // fill one inner level whose children's first keys are given by child_key
+            for(int n = 0; n * INNER_CARD < child_cnt; n++) {
+                INNode img;
+                for(int i = 0; i < INNER_CARD; i++) {
+                    int c = n * INNER_CARD + i;
+                    img.keys[i] = c < child_cnt ? child_key(c) : MAX_KEY;
+                }
+                persist_copy(&inner_nodes_[level_off + n], &img, sizeof(INNode));
+            }
         }
 
         void inner_print(int node_idx) {
@@ -382,11 +446,12 @@ inline entrance_t * get_entrance(Fixtree * tree) {
 
 inline void free(Fixtree * tree) {
     entrance_t * upent = get_entrance(tree);
+    PMAllocator * alc = tree->alc_;
     delete tree;
 
-    galc->free(galc->absolute(upent->inner_buff));
-    galc->free(galc->absolute(upent->leaf_buff));
-    galc->free(upent);
+    alc->free(alc->absolute(upent->inner_buff));
+    alc->free(alc->absolute(upent->leaf_buff));
+    alc->free(upent);
 
     return ;
 }
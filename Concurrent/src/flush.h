@@ -2,25 +2,105 @@
 #define __FLUSH_H__
 
 #include <x86intrin.h>
+#include <cpuid.h>
+#include <cstring>
+#include <cstdio>
+#include <glob.h>
 
 #include "common.h"
+#include "pmemu.h"
+#include "persist_meter.h"
 
 static inline void mfence() {
     asm volatile("sfence" ::: "memory");
+    if(pmemu_cfg.enabled) pmemu_fence();
+    meter_fence();
+}
+
+enum FlushType {FLUSH_CLFLUSH = 0, FLUSH_CLFLUSHOPT, FLUSH_CLWB};
+
+// the write-back instruction selected at start-up, defined in tlbtree_impl.cc
+extern FlushType flush_type;
+
+inline FlushType detect_flush_type() { // pick the cheapest write-back instruction the CPU supports
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        if(ebx & bit_CLWB) return FLUSH_CLWB;
+        if(ebx & bit_CLFLUSHOPT) return FLUSH_CLFLUSHOPT;
+    }
+    return FLUSH_CLFLUSH;
+}
+
+inline const char * flush_name(FlushType t = flush_type) {
+    static const char * names[] = {"clflush", "clflushopt", "clwb"};
+    return names[t];
+}
+
+enum PersistDomain {PERSIST_AUTO = 0, PERSIST_ADR, PERSIST_EADR};
+
+// true if CPU caches are inside the persistence domain (eADR), so write-backs are elided
+extern bool flush_elided;
+
+inline bool detect_eadr() {
+    // eADR only if every pmem region reports that CPU caches are flushed on power loss
+    glob_t g;
+    if(glob("/sys/bus/nd/devices/region*/persistence_domain", 0, NULL, &g) != 0)
+        return false;
+
+    bool eadr = g.gl_pathc > 0;
+    for(size_t i = 0; i < g.gl_pathc; i++) {
+        char domain[32] = {0};
+        FILE * f = fopen(g.gl_pathv[i], "r");
+        if(f == NULL || fgets(domain, sizeof(domain), f) == NULL || strncmp(domain, "cpu_cache", 9) != 0)
+            eadr = false;
+        if(f != NULL) fclose(f);
+    }
+    globfree(&g);
+    return eadr;
+}
+
+inline void set_persist_domain(PersistDomain d) {
+    flush_elided = (d == PERSIST_AUTO ? detect_eadr() : d == PERSIST_EADR);
+}
+
+/*
+ *  Set the domain by its name: adr, eadr or auto
+ *  return false if the name is unknown
+ */
+inline bool set_persist_domain(const char * name) {
+    static const char * NAMES[] = {"auto", "adr", "eadr"}; // in the order of PersistDomain
+    for(int d = PERSIST_AUTO; d <= PERSIST_EADR; d++) {
+        if(strcmp(NAMES[d], name) == 0) {
+            set_persist_domain((PersistDomain)d);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline const char * persist_domain_name() {
+    return flush_elided ? "eADR" : "ADR";
 }
 
 static inline void flush(void * ptr) {
-#ifdef CLWB
-    _mm_clwb(ptr);
-#elif defined(CLFLUSHOPT)
-    _mm_clflushopt(ptr);
-#else
-    _mm_clflush(ptr);
-#endif
+    if(pmemu_cfg.enabled) pmemu_flush();
+    meter_flush(ptr);
+    switch(flush_type) {
+    case FLUSH_CLWB:
+        _mm_clwb(ptr);
+        break;
+    case FLUSH_CLFLUSHOPT:
+        _mm_clflushopt(ptr);
+        break;
+    default:
+        _mm_clflush(ptr);
+        break;
+    }
 }
 
 inline void clwb(void *data, int len) {
 #ifdef DOFLUSH
+    if(flush_elided) return;
     volatile char *ptr = (char *)((unsigned long long)data &~(CACHE_LINE_SIZE-1));
     for(; ptr < (char *)data + len; ptr += CACHE_LINE_SIZE) {
         flush((void *)ptr);
@@ -33,13 +113,45 @@ inline void clflush(void *data, int len, bool fence=true)
 #ifdef DOFLUSH
     volatile char *ptr = (char *)((unsigned long long)data &~(CACHE_LINE_SIZE-1));
     if(fence) mfence();
-    for(; ptr < (char *)data + len; ptr += CACHE_LINE_SIZE){
+    for(; !flush_elided && ptr < (char *)data + len; ptr += CACHE_LINE_SIZE){
         flush((void *)ptr);
     }
     if(fence) mfence();
 #endif //DOFLUSH
 }
 
+// write freshly allocated objects with non-temporal stores instead of stores + clwb
+extern bool use_ntstore;
+
+inline void ntstore(void * dst, const void * src, size_t len) { 
+    // stream [src, src + len) into dst bypassing the cache, the caller issues the sfence
+    char * d = (char *)dst;
+    const char * s = (const char *)src;
+    for(uint64_t l = (uint64_t)d & ~(uint64_t)(CACHE_LINE_SIZE - 1); l < (uint64_t)d + len; l += CACHE_LINE_SIZE)
+        meter_flush((void *)l); // streamed lines are written to PM as well
+    size_t i = 0;
+    if(((uint64_t)d & 15) == 0) {
+        for(; i + 16 <= len; i += 16)
+            _mm_stream_si128((__m128i *)(d + i), _mm_loadu_si128((const __m128i *)(s + i)));
+    }
+    for(; i + 8 <= len; i += 8)
+        _mm_stream_si64((long long *)(d + i), *(const long long *)(s + i));
+    if(i < len) { // tail bytes with ordinary stores
+        memcpy(d + i, s + i, len - i);
+        clwb(d + i, len - i);
+    }
+}
+
+inline void persist_copy(void * dst, const void * src, size_t len) {
+    // persist the image of a freshly allocated object, without a fence
+    if(use_ntstore) {
+        ntstore(dst, src, len);
+    } else {
+        memcpy(dst, src, len);
+        clwb(dst, len);
+    }
+}
+
 template<typename T>
 inline void persist_assign(T* addr, const T &v) { // To ensure atomicity, the size of T should be less equal than 8
     *addr = v;
@@ -0,0 +1,95 @@
+/*  heat.h - sampled read/write heat of the sub-index trees
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __HEAT_H__
+#define __HEAT_H__
+
+#include <cstdint>
+#include <atomic>
+
+/*
+    HeatTable:
+        a volatile side table of read and write counts, indexed by a hash of the sub-index
+        root. Only one access out of SAMPLE is counted, so the shared counters stay cold, and
+        the counts of a slot are halved once they reach DECAY, so the heat follows the recent
+        workload. Slots are not tagged: roots that collide share their heat, and a sub-index
+        tree that grows a new root starts over. All of this only tunes where sub-index roots
+        split, it never affects correctness.
+*/
+class HeatTable {
+public:
+    enum Heat {NEUTRAL = 0, READ_HOT}; // writes only dilute the reads, a write-hot tree is NEUTRAL
+
+private:
+    static const int SLOT_BITS = 16;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const uint32_t SAMPLE = 16;
+    static const uint32_t DECAY = 1 << 10;
+    static const uint32_t MIN_SAMPLES = 16; // fewer samples than this is NEUTRAL
+
+    struct slot_t {
+        std::atomic<uint32_t> reads;
+        std::atomic<uint32_t> writes;
+    };
+    slot_t * slots_;
+
+public:
+    HeatTable(): slots_(new slot_t[SLOTS]()) {}
+
+    ~HeatTable() {
+        delete [] slots_;
+    }
+
+    HeatTable(const HeatTable &) = delete;
+    HeatTable & operator = (const HeatTable &) = delete;
+
+public:
+    inline void read(const void * subroot) const {
+        if(sampled()) count(slot(subroot), slot(subroot).reads);
+    }
+
+    inline void write(const void * subroot) const {
+        if(sampled()) count(slot(subroot), slot(subroot).writes);
+    }
+
+    Heat heat(const void * subroot) const {
+        return classify(slot(subroot));
+    }
+
+    uint64_t census() const { // the number of READ_HOT slots
+        uint64_t read_hot = 0;
+        for(int i = 0; i < SLOTS; i++)
+            read_hot += (classify(slots_[i]) == READ_HOT);
+        return read_hot;
+    }
+
+private:
+    static inline bool sampled() {
+        static thread_local uint32_t tick = 0;
+        return ++tick % SAMPLE == 0;
+    }
+
+    inline slot_t & slot(const void * subroot) const {
+        uint64_t h = ((uint64_t)subroot >> 8) * 0x9e3779b97f4a7c15UL; // nodes are 256B aligned
+        return slots_[h >> (64 - SLOT_BITS)];
+    }
+
+    static inline void count(slot_t & s, std::atomic<uint32_t> & c) {
+        if(c.fetch_add(1, std::memory_order_relaxed) + 1 >= DECAY) { // racy halving, fine for a heuristic
+            s.reads.store(s.reads.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+            s.writes.store(s.writes.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+        }
+    }
+
+    static Heat classify(const slot_t & s) {
+        uint32_t r = s.reads.load(std::memory_order_relaxed);
+        uint32_t w = s.writes.load(std::memory_order_relaxed);
+        if(r + w < MIN_SAMPLES) return NEUTRAL;
+        if(r * 10 >= (r + w) * 9) return READ_HOT; // at least 90% reads
+        return NEUTRAL;
+    }
+};
+
+#endif // __HEAT_H__
@@ -0,0 +1,85 @@
+/*  numa.h - NUMA nodes of the machine and of the calling thread, without libnuma
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <glob.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+    The nodes are read from /sys/devices/system/node, a machine without it (or a kernel built
+    without NUMA) is one node 0 holding all the CPUs.
+*/
+namespace numa {
+
+inline int node_cnt() {
+    glob_t g;
+    int cnt = 1;
+    if(glob("/sys/devices/system/node/node[0-9]*", 0, NULL, &g) == 0)
+        cnt = g.gl_pathc;
+    globfree(&g);
+    return cnt > 0 ? cnt : 1;
+}
+
+inline bool node_cpus(int node, cpu_set_t & cpus) { // parse the cpulist of node, e.g. "0-3,8-11"
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE * fp = fopen(path, "r");
+    if(fp == NULL) return false;
+
+    CPU_ZERO(&cpus);
+    int lo, hi;
+    while(fscanf(fp, "%d", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(fp);
+        if(c == '-') {
+            if(fscanf(fp, "%d", &hi) != 1) break;
+            c = fgetc(fp);
+        }
+        for(int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &cpus);
+        if(c != ',') break;
+    }
+    fclose(fp);
+    return CPU_COUNT(&cpus) > 0;
+}
+
+inline bool pin(int node) { // run the calling thread on the CPUs of node only
+    cpu_set_t cpus;
+    if(node < 0 || !node_cpus(node, cpus)) return false;
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+inline std::vector<int> cpu_nodes() { // the node of every CPU
+    std::vector<int> nodes(CPU_SETSIZE, 0);
+    glob_t g;
+    if(glob("/sys/devices/system/node/node[0-9]*", 0, NULL, &g) == 0) {
+        for(size_t i = 0; i < g.gl_pathc; i++) {
+            int node = atoi(strrchr(g.gl_pathv[i], 'e') + 1); // ".../nodeN"
+            cpu_set_t cpus;
+            if(!node_cpus(node, cpus)) continue;
+            for(int c = 0; c < CPU_SETSIZE; c++)
+                if(CPU_ISSET(c, &cpus)) nodes[c] = node;
+        }
+    }
+    globfree(&g);
+    return nodes;
+}
+
+inline int local_node() { // the node the calling thread runs on now, sched_getcpu() is served by the vDSO
+    static const std::vector<int> nodes = cpu_nodes();
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < CPU_SETSIZE ? nodes[cpu] : 0;
+}
+
+} // namespace numa
+
+#endif // __NUMA_H__
@@ -0,0 +1,82 @@
+/*  persist_batch.h - coalesce cache-line write-backs between ordering points
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __PERSIST_BATCH_H__
+#define __PERSIST_BATCH_H__
+
+#include <cstdint>
+
+#include "flush.h"
+
+/*
+    PersistBatch:
+        records the cache lines dirtied by a thread and writes each of them back once at the
+        next ordering point. Only cache lines are deduplicated, XPLines are not tracked: the
+        lines are issued in address order, so lines of the same 256B XPLine reach the DIMM
+        back to back and can be combined in its write buffer.
+
+        add()   record a dirty range, nothing is written back yet
+        fence() ordering point: write back all recorded lines, then one sfence
+        flush() end of an operation: write back all recorded lines without a fence
+*/
+class PersistBatch {
+private:
+    static const int MAX_LINES = 32;
+
+    uint64_t lines_[MAX_LINES];
+    int cnt_;
+
+public:
+    constexpr PersistBatch(): lines_(), cnt_(0) {}
+
+    PersistBatch(const PersistBatch &) = delete;
+    PersistBatch & operator = (const PersistBatch &) = delete;
+
+    static PersistBatch & local() { // the batch of the calling thread
+        static thread_local PersistBatch pb;
+        return pb;
+    }
+
+public:
+    inline void add(const void * addr, size_t len) {
+        uint64_t line = (uint64_t)addr & ~(uint64_t)(CACHE_LINE_SIZE - 1);
+        for(; line < (uint64_t)addr + len; line += CACHE_LINE_SIZE) {
+            int i = 0;
+            while(i < cnt_ && lines_[i] != line) i++;
+            if(i < cnt_) continue; // already recorded in this epoch
+
+            if(cnt_ == MAX_LINES) flush();
+            lines_[cnt_++] = line;
+        }
+    }
+
+    template<typename T>
+    inline void assign(T * addr, const T & v) { // To ensure atomicity, the size of T should be less equal than 8
+        *addr = v;
+        add(addr, sizeof(T));
+    }
+
+    inline void fence() {
+        flush();
+        mfence();
+    }
+
+    inline void flush() {
+        // sort the lines so that lines in one XPLine are written back together
+        for(int i = 1; i < cnt_; i++) {
+            uint64_t l = lines_[i];
+            int j = i - 1;
+            for(; j >= 0 && lines_[j] > l; j--)
+                lines_[j + 1] = lines_[j];
+            lines_[j + 1] = l;
+        }
+
+        for(int i = 0; i < cnt_; i++)
+            clwb((void *)lines_[i], CACHE_LINE_SIZE);
+        cnt_ = 0;
+    }
+};
+
+#endif // __PERSIST_BATCH_H__
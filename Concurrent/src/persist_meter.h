@@ -0,0 +1,194 @@
+/*  persist_meter.h - count the persistence cost of each index operation
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __PERSIST_METER_H__
+#define __PERSIST_METER_H__
+
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <algorithm>
+
+/*
+    Persist meter:
+        every thread counts the cache lines it writes back, the fences it issues and the
+        distinct 256B XPLines it touches during the current operation. When the operation
+        ends, the counts are added to the totals of its operation type. Structural changes
+        (down layer splits, top layer inserts) are attributed the same way.
+        A thread registers its meter in a slot of the registry. When the thread exits, its
+        totals are folded into the registry and the slot is reused by the next thread.
+*/
+namespace meter {
+
+enum OpType {READ = 0, INSERT, UPDATE, DELETE, REBUILD, OP_TYPES};
+
+inline constexpr const char * OP_NAMES[OP_TYPES] = {"read", "insert", "update", "delete", "rebuild"};
+
+struct counter_t {
+    uint64_t ops;
+    uint64_t lines;     // cache lines written back
+    uint64_t fences;
+    uint64_t xplines;   // distinct XPLines written back per operation, summed
+    uint64_t splits;    // down layer node splits
+    uint64_t upinserts; // sub-index roots inserted into the top layer
+
+    void add(const counter_t & c) {
+        ops += c.ops; lines += c.lines; fences += c.fences;
+        xplines += c.xplines; splits += c.splits; upinserts += c.upinserts;
+    }
+};
+
+struct thread_meter_t {
+    static const int MAX_XPLINES = 32;
+
+    counter_t cur;                  // the running operation
+    uint64_t xpl[MAX_XPLINES];      // XPLines touched by the running operation
+    int xpl_cnt;
+    int depth;                      // meter scopes open in this thread
+    int slot;                       // in the registry, -1 if all the slots were taken
+    counter_t total[OP_TYPES];
+
+    void touch(uint64_t line) {
+        uint64_t x = line >> 8;
+        for(int i = 0; i < xpl_cnt; i++)
+            if(xpl[i] == x) return;
+        if(xpl_cnt < MAX_XPLINES) // beyond that, every line counts as a new XPLine
+            xpl[xpl_cnt++] = x;
+        cur.xplines++;
+    }
+};
+
+static const int MAX_THREADS = 1024;
+
+struct registry_t {
+    std::mutex mtx;
+    thread_meter_t * meters[MAX_THREADS];   // of the running threads, NULL in a free slot
+    counter_t retired[OP_TYPES];            // the totals of the threads that exited
+};
+
+} // namespace meter
+
+// whether the meter is counting, and the meters of all threads, defined in tlbtree_impl.cc
+extern bool meter_enabled;
+extern meter::registry_t meter_registry;
+
+struct meter_holder_t { // the meter of a thread, retired when the thread exits
+    meter::thread_meter_t * m = nullptr;
+
+    meter::thread_meter_t * get() {
+        if(m == nullptr) {
+            m = new meter::thread_meter_t();
+            std::lock_guard<std::mutex> lock(meter_registry.mtx);
+            m->slot = -1; // beyond MAX_THREADS running threads, the meter is reported once it exits
+            for(int i = 0; i < meter::MAX_THREADS && m->slot < 0; i++) {
+                if(meter_registry.meters[i] == nullptr) {
+                    meter_registry.meters[i] = m;
+                    m->slot = i;
+                }
+            }
+        }
+        return m;
+    }
+
+    ~meter_holder_t() {
+        if(m == nullptr) return;
+        std::lock_guard<std::mutex> lock(meter_registry.mtx);
+        for(int op = 0; op < meter::OP_TYPES; op++)
+            meter_registry.retired[op].add(m->total[op]);
+        if(m->slot >= 0) meter_registry.meters[m->slot] = nullptr;
+        delete m;
+    }
+};
+
+inline meter::thread_meter_t * local_meter() {
+    static thread_local meter_holder_t holder;
+    return holder.get();
+}
+
+inline void meter_flush(void * line) {
+    if(meter_enabled) {
+        meter::thread_meter_t * m = local_meter();
+        m->cur.lines++;
+        m->touch((uint64_t)line);
+    }
+}
+
+inline void meter_fence() {
+    if(meter_enabled) local_meter()->cur.fences++;
+}
+
+inline void meter_split() {
+    if(meter_enabled) local_meter()->cur.splits++;
+}
+
+inline void meter_upinsert() {
+    if(meter_enabled) local_meter()->cur.upinserts++;
+}
+
+/* attribute the persistence cost between construction and destruction to one operation type.
+    A scope opened inside another one (a rebuild run by an insert) sets the counts and XPLines
+    of the outer operation aside, and gives them back when it ends */
+class meter_scope_t {
+    meter::OpType op_;
+    bool on_;
+    int depth_;
+    meter::counter_t outer_;
+    uint64_t outer_xpl_[meter::thread_meter_t::MAX_XPLINES];
+    int outer_xpl_cnt_;
+public:
+    meter_scope_t(meter::OpType op): op_(op), on_(meter_enabled) {
+        if(on_) {
+            meter::thread_meter_t * m = local_meter();
+            depth_ = m->depth++;
+            outer_ = m->cur;
+            outer_xpl_cnt_ = m->xpl_cnt;
+            std::copy(m->xpl, m->xpl + m->xpl_cnt, outer_xpl_);
+            m->cur = meter::counter_t();
+            m->xpl_cnt = 0;
+        }
+    }
+
+    ~meter_scope_t() {
+        if(on_) {
+            meter::thread_meter_t * m = local_meter();
+            assert(m->depth == depth_ + 1); // the scopes of a thread end in the reverse order
+            m->depth = depth_;
+            m->cur.ops = 1;
+            m->total[op_].add(m->cur);
+            m->cur = outer_;
+            m->xpl_cnt = outer_xpl_cnt_;
+            std::copy(outer_xpl_, outer_xpl_ + outer_xpl_cnt_, m->xpl);
+        }
+    }
+
+    meter_scope_t(const meter_scope_t &) = delete;
+    meter_scope_t & operator = (const meter_scope_t &) = delete;
+};
+
+// sum the totals of all threads, call it when no operation is running
+inline void meter_report(meter::counter_t (&out)[meter::OP_TYPES]) {
+    std::lock_guard<std::mutex> lock(meter_registry.mtx);
+    for(int op = 0; op < meter::OP_TYPES; op++)
+        out[op] = meter_registry.retired[op];
+
+    for(int t = 0; t < meter::MAX_THREADS; t++) {
+        if(meter_registry.meters[t] == nullptr) continue;
+        for(int op = 0; op < meter::OP_TYPES; op++)
+            out[op].add(meter_registry.meters[t]->total[op]);
+    }
+}
+
+inline void meter_reset() {
+    std::lock_guard<std::mutex> lock(meter_registry.mtx);
+    for(int op = 0; op < meter::OP_TYPES; op++)
+        meter_registry.retired[op] = meter::counter_t();
+    for(int t = 0; t < meter::MAX_THREADS; t++) {
+        if(meter_registry.meters[t] == nullptr) continue;
+        for(int op = 0; op < meter::OP_TYPES; op++)
+            meter_registry.meters[t]->total[op] = meter::counter_t();
+    }
+}
+
+#endif // __PERSIST_METER_H__
@@ -8,11 +8,16 @@
 
 #include <cassert>
 #include <cstdio>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <sys/stat.h>
 #include <libpmemobj.h>
 
 #include "common.h"
 #include "flush.h"
 #include "spinlock.h"
+#include "numa.h"
 
 POBJ_LAYOUT_BEGIN(pmallocator);
 POBJ_LAYOUT_TOID(pmallocator, char)
@@ -25,11 +30,21 @@ POBJ_LAYOUT_END(pmallocator)
     It uses malloc() and free() as the allocation and reclaiment interfaces. 
     Other public interfaces like get_root(), absolute() and relative() are essential to memory
     management in persistent environment. 
+
+    One allocator may span several pool files, one per NUMA node (pool i is meant to live on
+    node i). A thread allocates from the pool of the node it runs on, so the nodes split and
+    built by local threads stay local, and from the next pools once that one is full. A freed
+    block goes back to the pool it came from.
+    The root entry lives in pool 0, and the pools must be reopened in the same order.
 */
 class PMAllocator {
 private:
     static const int PEICE_CNT = 64;
     static const size_t ALIGN_SIZE = 256;
+    static const int MAX_POOLS = 8;
+    // a relative pointer is the offset in its pool, with the id of the pool in the high bits
+    static const int POOL_SHIFT = 48;
+    static const uint64_t OFFSET_MASK = (1UL << POOL_SHIFT) - 1;
     
     struct MetaType {
         char * buffer[PEICE_CNT];
@@ -37,17 +52,30 @@ private:
         size_t cur_blk;
         // entrance of DS in buffer
         void * entrance;
+        uint32_t pool_id;
+        uint32_t pool_cnt;  // 0 in pools made before allocators spanned several
     };
-    MetaType * meta_;
 
     // volatile domain
-    PMEMobjpool *pop_;
+    struct pool_t {
+        PMEMobjpool *pop;
+        size_t map_size;
+        MetaType * meta;
+        char * buff[PEICE_CNT];
+        char * buff_aligned[PEICE_CNT];
+        size_t piece_size;
+        size_t max_blk;
+        Spinlock alloc_mtx;
+        // blocks freed since the pool was mapped, reused by single block allocations. The list is
+        // volatile, what is on it at a shutdown or crash is leaked, as all the freed blocks were before
+        Spinlock free_mtx;
+        std::vector<void *> free_blks;
+        std::atomic<size_t> free_cnt;
+    } __attribute__((aligned(64)));
 
-    char * buff_[PEICE_CNT];
-    char * buff_aligned_[PEICE_CNT];
-    size_t piece_size_;
-    size_t max_blk_;
-    Spinlock alloc_mtx;
+    char * bases_[MAX_POOLS];   // the mapped address of each pool, read by absolute()
+    int pool_cnt_;
+    pool_t * pools_;
 
 public: 
     /*
@@ -57,53 +85,29 @@ public:
      *  @param layout_name  ID of a group of allocations (in characters), each ID corresponding to a root entry
      *  @param pool_size    pool size of the pool file, vaild if the file doesn't exist
      */
-    PMAllocator(const char *file_name, bool recover, const char *layout_name, uint64_t pool_size) {
-        PMEMobjpool *tmp_pool = nullptr;
+    PMAllocator(const char *file_name, bool recover, const char *layout_name, uint64_t pool_size)
+        : PMAllocator(std::vector<std::string>{file_name}, recover, layout_name, pool_size) {}
+
+    /*
+     *  Construct a PM allocator over one pool file per NUMA node, file_names[i] on node i
+     *  @param pool_size    the size of each pool file
+     */
+    PMAllocator(const std::vector<std::string> & file_names, bool recover, const char *layout_name, uint64_t pool_size)
+        : pool_cnt_(file_names.size()), pools_(new pool_t[file_names.size()]) {
+        assert(pool_cnt_ > 0 && pool_cnt_ <= MAX_POOLS);
         pool_size = pool_size + ((pool_size & ((1 << 23) - 1)) > 0 ? (1 << 23) : 0); // align to 8MB
-	    if(recover == false) {
-            if(file_exist(file_name)) {
-                printf("[CAUTIOUS]: The pool file already exists\n");
-                printf("Try (1) remove the pool file %s\nOr  (2) set the recover parameter to be true\n", file_name);
-                exit(-1);
-            }
-            pop_ = pmemobj_create(file_name, layout_name, pool_size, S_IWUSR | S_IRUSR);
-            meta_ = (MetaType *)pmemobj_direct(pmemobj_root(pop_, sizeof(MetaType)));
-            
-            // maintain volatile domain
-            uint64_t alloc_size = (pool_size >> 1) + (pool_size >> 2) + (pool_size >> 3); // 7/8 of the pool is used as block alloction
-            for(int i = 0; i < PEICE_CNT; i++) {
-                buff_[i] = (char *)mem_alloc(alloc_size / PEICE_CNT);
-                buff_aligned_[i] = (char *) ((uint64_t)buff_[i] + ((uint64_t) buff_[i] % ALIGN_SIZE == 0 ? 0 : (ALIGN_SIZE - (uint64_t) buff_[i] % ALIGN_SIZE)));
-            }
-            piece_size_ = (alloc_size / PEICE_CNT) / ALIGN_SIZE - 1;
-            max_blk_ = piece_size_ * PEICE_CNT;
-            
-            // initialize meta_
-            for(int i = 0; i < PEICE_CNT; i++) 
-                meta_->buffer[i] = relative(buff_[i]);
-            meta_->blk_per_piece = piece_size_;
-            meta_->cur_blk = 0;
-            meta_->entrance = NULL;
-            clwb(meta_, sizeof(MetaType));
-        } else {
-            if(!file_exist(file_name)) {
-                printf("Pool File Not Exist\n");
-		        exit(-1);
-	        }
-            pop_ = pmemobj_open(file_name, layout_name);
-            meta_ = (MetaType *)pmemobj_direct(pmemobj_root(pop_, sizeof(MetaType)));
-            // maintain volatile domain
-            for(int i = 0; i < PEICE_CNT; i++) {
-                buff_[i] = absolute(meta_->buffer[i]);
-                buff_aligned_[i] = (char *) ((uint64_t)buff_[i] + ((uint64_t) buff_[i] % ALIGN_SIZE == 0 ? 0 : (ALIGN_SIZE - (uint64_t) buff_[i] % ALIGN_SIZE)));
-            }
-            piece_size_ = meta_->blk_per_piece;
-            max_blk_ = piece_size_ * PEICE_CNT;
-        }
+        for(int i = 0; i < MAX_POOLS; i++)
+            bases_[i] = NULL;
+        for(int i = 0; i < pool_cnt_; i++)
+            pools_[i].map_size = 0; // not mapped yet, see pool_of()
+        for(int i = 0; i < pool_cnt_; i++)
+            open_pool(i, file_names[i].c_str(), recover, layout_name, pool_size);
     }
 
     ~PMAllocator() {
-        pmemobj_close(pop_);
+        for(int i = 0; i < pool_cnt_; i++)
+            pmemobj_close(pools_[i].pop);
+        delete [] pools_;
     }
 
 public:
@@ -116,70 +120,45 @@ public:
      *  Each group of allocations is a independent, self-contained in-memory structure in the pool
      *  such as b-tree or link-list
      */
-    void * get_root(size_t nsize) { // the root of DS stored in buff_ is recorded at meta_->entrance
-        if(meta_->entrance == NULL) {
-            meta_->entrance = relative(malloc(nsize));
-            clwb(meta_, sizeof(MetaType));
+    void * get_root(size_t nsize) { // the root of DS stored in buff_ is recorded at meta->entrance of pool 0
+        MetaType * meta = pools_[0].meta;
+        if(meta->entrance == NULL) {
+            meta->entrance = relative(malloc(nsize));
+            clwb(meta, sizeof(MetaType));
         }
-        return absolute(meta_->entrance);
+        return absolute(meta->entrance);
+    }
+
+    void * root() { // the root entry if there is one, NULL otherwise, without allocating it
+        return absolute(pools_[0].meta->entrance);
     }
 
     /*
-     *  Allocate a non-root piece of persistent memory from the mapped pool
+     *  Allocate a non-root piece of persistent memory from the pool of the calling thread's node,
+     *  or from the next pool that has room when that one is full
      *  return the virtual memory address
      */
     void * malloc(size_t nsize) { 
-        if(nsize >= (1 << 12)) { // large than 4KB, make sure it is atomic
-            void * mem = mem_alloc(nsize + ALIGN_SIZE); // not aligned
-            //  |  UNUSED    |HEADER|       memory you can use     |
-            // mem             (mem + off)
-            uint64_t offset = ALIGN_SIZE - (uint64_t)mem % ALIGN_SIZE;
-            // store a header in the front
-            uint64_t * header = (uint64_t *)((uint64_t)mem + offset - 8);
-            *header = offset;
-
-            return (void *)((uint64_t)mem + offset);
-        }
-        
-        retry_malloc:
-        uint64_t old_cur_blk = meta_->cur_blk;
-
-        int blk_demand = (nsize + ALIGN_SIZE - 1) / ALIGN_SIZE;
-        // case 1: not enough in the buffer
-        if(blk_demand + meta_->cur_blk > max_blk_) {
-            printf("run out of memory\n");
-            exit(-1);
-        }
-        // case 2: current piece can not accommdate this allocation
-        int piece_id = meta_->cur_blk / piece_size_;
-        if((meta_->cur_blk % piece_size_ + blk_demand) > piece_size_) {
-            void * mem = buff_aligned_[piece_id + 1]; // allocate from a new peice
-
-            uint64_t new_cur_blk = piece_size_ * (piece_id + 1) + blk_demand;
-            if(__sync_bool_compare_and_swap(&(meta_->cur_blk), old_cur_blk, new_cur_blk) == false) 
-                goto retry_malloc;
-            clwb(&(meta_->cur_blk), 8);
-
-            return mem;
-        } 
-        // case 3: current piece has enough space
-        else {
-            void * mem = buff_aligned_[piece_id] + ALIGN_SIZE * (meta_->cur_blk % piece_size_);
-
-            uint64_t new_cur_blk = old_cur_blk + blk_demand;
-            if(__sync_bool_compare_and_swap(&(meta_->cur_blk), old_cur_blk, new_cur_blk) == false) 
-                goto retry_malloc;
-            clwb(&(meta_->cur_blk), 8);
-
-            return mem;
+        int home = local_pool();
+        for(int i = 0; i < pool_cnt_; i++) {
+            void * mem = malloc_from(pools_[(home + i) % pool_cnt_], nsize);
+            if(mem != NULL) return mem;
         }
+        printf("run out of memory\n");
+        exit(-1);
     }
 
     void free(void* addr) {
+        pool_t & p = pools_[pool_of(addr)];
         for(int i = 0; i < PEICE_CNT; i++) {
-            uint64_t offset = (uint64_t)addr - (uint64_t)buff_aligned_[i];
-            if(offset > 0 && offset < piece_size_ * ALIGN_SIZE) {
-                // the addr is in this piece, do not reclaim it
+            uint64_t offset = (uint64_t)addr - (uint64_t)p.buff_aligned[i];
+            if(offset < p.piece_size * ALIGN_SIZE) {
+                // the addr is in this piece, keep it for the next single block allocation
+                // (only nodes of one block are freed one by one)
+                p.free_mtx.lock();
+                    p.free_blks.push_back(addr);
+                    p.free_cnt.store(p.free_blks.size(), std::memory_order_relaxed);
+                p.free_mtx.unlock();
                 return ;
             }
         }
@@ -188,15 +167,76 @@ public:
         uint64_t * header = (uint64_t *)((uint64_t)addr - 8);
         uint64_t offset = *header; 
 
-        alloc_mtx.lock();
+        p.alloc_mtx.lock();
         auto oid_ptr = pmemobj_oid((void *)((uint64_t)addr - offset));
-        alloc_mtx.unlock();
+        p.alloc_mtx.unlock();
 
         TOID(char) ptr_cpy;
         TOID_ASSIGN(ptr_cpy, oid_ptr);
         POBJ_FREE(&ptr_cpy);
     }  
 
+    /*
+     *  The number of blocks allocated so far, and the virtual memory address of a block, summed
+     *  over all the pools and numbered pool by pool
+     *  malloc() reports "run out of memory" when all the pools are full
+     */
+    inline size_t used_blocks() const {
+        size_t cnt = 0;
+        for(int i = 0; i < pool_cnt_; i++)
+            cnt += pools_[i].meta->cur_blk;
+        return cnt;
+    }
+
+    inline size_t free_blocks() const { // freed blocks waiting for reuse, included in used_blocks()
+        size_t cnt = 0;
+        for(int i = 0; i < pool_cnt_; i++)
+            cnt += pools_[i].free_cnt.load(std::memory_order_relaxed);
+        return cnt;
+    }
+
+    inline size_t max_blocks() const {
+        size_t cnt = 0;
+        for(int i = 0; i < pool_cnt_; i++)
+            cnt += pools_[i].max_blk;
+        return cnt;
+    }
+
+    /*
+     *  The bytes left in the pools for objects of 4KB or more, the top layer arrays and entrances
+     *  and the restore buffer. They come from what the blocks leave of each pool, about 1/8 of it.
+     *  libpmemobj's own metadata is not counted, the real headroom is a little smaller
+     */
+    size_t large_headroom() {
+        size_t room = 0;
+        for(int i = 0; i < pool_cnt_; i++) {
+            pool_t & p = pools_[i];
+            size_t used = sizeof(MetaType);
+            p.alloc_mtx.lock();
+                for(PMEMoid oid = pmemobj_first(p.pop); !OID_IS_NULL(oid); oid = pmemobj_next(oid))
+                    used += pmemobj_alloc_usable_size(oid);
+            p.alloc_mtx.unlock();
+            room += p.map_size - std::min(p.map_size, used);
+        }
+        return room;
+    }
+
+    static constexpr size_t block_size() {
+        return ALIGN_SIZE;
+    }
+
+    inline void * block_addr(size_t blk) const {
+        int i = 0;
+        while(i < pool_cnt_ - 1 && blk >= pools_[i].meta->cur_blk)
+            blk -= pools_[i++].meta->cur_blk;
+        const pool_t & p = pools_[i];
+        return p.buff_aligned[blk / p.piece_size] + ALIGN_SIZE * (blk % p.piece_size);
+    }
+
+    inline int pool_cnt() const {
+        return pool_cnt_;
+    }
+
     /*
      *  Distinguish from virtual memory address and offset in the pool
      *  Each memory piece allocated from the pool has an in-pool offset, which remains unchanged
@@ -214,30 +254,159 @@ public:
     inline T *absolute(T *pmem_offset) {
         if(pmem_offset == NULL)
             return NULL;
-        return reinterpret_cast<T *>(reinterpret_cast<uint64_t>(pmem_offset) + reinterpret_cast<char *>(pop_));
+        uint64_t rel = reinterpret_cast<uint64_t>(pmem_offset);
+        return reinterpret_cast<T *>((rel & OFFSET_MASK) + bases_[rel >> POOL_SHIFT]);
     }
     
     template<typename T>
     inline T *relative(T *pmem_direct) {
         if(pmem_direct == NULL)
             return NULL;
-        return reinterpret_cast<T *>(reinterpret_cast<char *>(pmem_direct) - reinterpret_cast<char *>(pop_));
+        uint64_t id = pool_cnt_ == 1 ? 0 : pool_of(pmem_direct);
+        return reinterpret_cast<T *>((reinterpret_cast<char *>(pmem_direct) - bases_[id]) + (id << POOL_SHIFT));
     }
 
 private:
-    void * mem_alloc(size_t nsize) {
+    void * malloc_from(pool_t & p, size_t nsize) { // NULL if p is full
+        if(nsize >= (1 << 12)) { // large than 4KB, make sure it is atomic
+            void * mem = mem_alloc(p, nsize + ALIGN_SIZE); // not aligned
+            if(mem == NULL) return NULL;
+            //  |  UNUSED    |HEADER|       memory you can use     |
+            // mem             (mem + off)
+            uint64_t offset = ALIGN_SIZE - (uint64_t)mem % ALIGN_SIZE;
+            // store a header in the front
+            uint64_t * header = (uint64_t *)((uint64_t)mem + offset - 8);
+            *header = offset;
+
+            return (void *)((uint64_t)mem + offset);
+        }
+        
+        if(nsize <= ALIGN_SIZE && p.free_cnt.load(std::memory_order_relaxed) > 0) { // reuse a freed block
+            void * mem = NULL;
+            p.free_mtx.lock();
+                if(!p.free_blks.empty()) {
+                    mem = p.free_blks.back();
+                    p.free_blks.pop_back();
+                    p.free_cnt.store(p.free_blks.size(), std::memory_order_relaxed);
+                }
+            p.free_mtx.unlock();
+            if(mem != NULL) return mem;
+        }
+
+        MetaType * meta = p.meta;
+        retry_malloc:
+        uint64_t old_cur_blk = meta->cur_blk;
+
+        int blk_demand = (nsize + ALIGN_SIZE - 1) / ALIGN_SIZE;
+        // case 1: not enough in the buffer
+        if(blk_demand + meta->cur_blk > p.max_blk) {
+            return NULL;
+        }
+        // case 2: current piece can not accommdate this allocation
+        int piece_id = meta->cur_blk / p.piece_size;
+        if((meta->cur_blk % p.piece_size + blk_demand) > p.piece_size) {
+            void * mem = p.buff_aligned[piece_id + 1]; // allocate from a new peice
+
+            uint64_t new_cur_blk = p.piece_size * (piece_id + 1) + blk_demand;
+            if(__sync_bool_compare_and_swap(&(meta->cur_blk), old_cur_blk, new_cur_blk) == false) 
+                goto retry_malloc;
+            clwb(&(meta->cur_blk), 8);
+
+            return mem;
+        } 
+        // case 3: current piece has enough space
+        else {
+            void * mem = p.buff_aligned[piece_id] + ALIGN_SIZE * (meta->cur_blk % p.piece_size);
+
+            uint64_t new_cur_blk = old_cur_blk + blk_demand;
+            if(__sync_bool_compare_and_swap(&(meta->cur_blk), old_cur_blk, new_cur_blk) == false) 
+                goto retry_malloc;
+            clwb(&(meta->cur_blk), 8);
+
+            return mem;
+        }
+    }
+
+    void open_pool(int id, const char * file_name, bool recover, const char * layout_name, uint64_t pool_size) {
+        pool_t & p = pools_[id];
+        p.free_cnt.store(0, std::memory_order_relaxed);
+	    if(recover == false) {
+            if(file_exist(file_name)) {
+                printf("[CAUTIOUS]: The pool file already exists\n");
+                printf("Try (1) remove the pool file %s\nOr  (2) set the recover parameter to be true\n", file_name);
+                exit(-1);
+            }
+            p.pop = pmemobj_create(file_name, layout_name, pool_size, S_IWUSR | S_IRUSR);
+            p.map_size = pool_size;
+            p.meta = (MetaType *)pmemobj_direct(pmemobj_root(p.pop, sizeof(MetaType)));
+            bases_[id] = (char *)p.pop;
+            
+            // maintain volatile domain
+            uint64_t alloc_size = (pool_size >> 1) + (pool_size >> 2) + (pool_size >> 3); // 7/8 of the pool is used as block alloction
+            for(int i = 0; i < PEICE_CNT; i++) {
+                p.buff[i] = (char *)mem_alloc(p, alloc_size / PEICE_CNT);
+                assert(p.buff[i] != NULL);
+                p.buff_aligned[i] = (char *) ((uint64_t)p.buff[i] + ((uint64_t) p.buff[i] % ALIGN_SIZE == 0 ? 0 : (ALIGN_SIZE - (uint64_t) p.buff[i] % ALIGN_SIZE)));
+            }
+            p.piece_size = (alloc_size / PEICE_CNT) / ALIGN_SIZE - 1;
+            p.max_blk = p.piece_size * PEICE_CNT;
+            
+            // initialize meta
+            for(int i = 0; i < PEICE_CNT; i++) 
+                p.meta->buffer[i] = relative(p.buff[i]);
+            p.meta->blk_per_piece = p.piece_size;
+            p.meta->cur_blk = 0;
+            p.meta->entrance = NULL;
+            p.meta->pool_id = id;
+            p.meta->pool_cnt = pool_cnt_;
+            clwb(p.meta, sizeof(MetaType));
+        } else {
+            if(!file_exist(file_name)) {
+                printf("Pool File Not Exist\n");
+		        exit(-1);
+	        }
+            p.pop = pmemobj_open(file_name, layout_name);
+            struct stat st;
+            stat(file_name, &st);
+            p.map_size = st.st_size;
+            p.meta = (MetaType *)pmemobj_direct(pmemobj_root(p.pop, sizeof(MetaType)));
+            bases_[id] = (char *)p.pop;
+            bool legacy = p.meta->pool_cnt == 0; // a pool of its own
+            if(legacy ? pool_cnt_ > 1 : (p.meta->pool_id != (uint32_t)id || p.meta->pool_cnt != (uint32_t)pool_cnt_)) {
+                printf("[CAUTIOUS]: The pool file %s is not pool %d of %d\n", file_name, id, pool_cnt_);
+                exit(-1);
+            }
+            // maintain volatile domain
+            for(int i = 0; i < PEICE_CNT; i++) {
+                p.buff[i] = absolute(p.meta->buffer[i]);
+                p.buff_aligned[i] = (char *) ((uint64_t)p.buff[i] + ((uint64_t) p.buff[i] % ALIGN_SIZE == 0 ? 0 : (ALIGN_SIZE - (uint64_t) p.buff[i] % ALIGN_SIZE)));
+            }
+            p.piece_size = p.meta->blk_per_piece;
+            p.max_blk = p.piece_size * PEICE_CNT;
+        }
+    }
+
+    inline int local_pool() const { // pool i is on node i, nodes beyond the pools wrap around
+        return pool_cnt_ == 1 ? 0 : numa::local_node() % pool_cnt_;
+    }
+
+    inline int pool_of(const void * addr) const {
+        for(int i = 1; i < pool_cnt_; i++) {
+            if((uint64_t)addr - (uint64_t)bases_[i] < pools_[i].map_size)
+                return i;
+        }
+        return 0;
+    }
+
+    void * mem_alloc(pool_t & p, size_t nsize) {
         PMEMoid tmp;
 
-        alloc_mtx.lock();
-        pmemobj_alloc(pop_, &tmp, nsize, TOID_TYPE_NUM(char), NULL, NULL);
-        alloc_mtx.unlock();
+        p.alloc_mtx.lock();
+        int ret = pmemobj_alloc(p.pop, &tmp, nsize, TOID_TYPE_NUM(char), NULL, NULL);
+        p.alloc_mtx.unlock();
         
-        void * mem = pmemobj_direct(tmp);
-        assert(mem != nullptr);
-        return mem;
+        return ret == 0 ? pmemobj_direct(tmp) : NULL; // NULL if the pool is full
     }
 };
 
-extern PMAllocator * galc;
-
 #endif // __BLKALLOCATOR_H__
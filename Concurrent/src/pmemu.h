@@ -0,0 +1,132 @@
+/*  pmemu.h - emulate persistent memory latency and bandwidth on DRAM-only hosts
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __PMEMU_H__
+#define __PMEMU_H__
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <x86intrin.h>
+
+/*
+    PM emulation:
+        when enabled, every flushed cache line, every fence and every PM cache line read
+        on a node hop is charged an extra delay, spinning on the TSC. Flushed lines can
+        additionally be throttled by a token bucket that models the write bandwidth of
+        the DIMMs. The delays are the gap between PM and DRAM, so they are added on top
+        of what the host DRAM costs already.
+*/
+namespace pmemu {
+
+struct profile_t {
+    const char * name;
+    uint32_t read_ns;       // extra latency of reading one 256B XPLine missed in cache
+    uint32_t flush_ns;      // extra latency of issuing one cache line write-back
+    uint32_t fence_ns;      // extra latency of a fence draining the write-backs
+    uint32_t write_mbps;    // write bandwidth of the pool, 0 for unlimited
+};
+
+// derived from published measurements of random 64B accesses to Optane DC PMM (App Direct)
+static const profile_t PROFILES[] = {
+    {"dram",              0,  0,  0,     0},
+    {"optane100",       220, 10, 90, 12000}, // 6 interleaved 100 series DIMMs per socket
+    {"optane100-1dimm", 220, 10, 90,  2300}, // a single non-interleaved 100 series DIMM
+    {"optane200",       200, 10, 80, 15000}, // 8 interleaved 200 series DIMMs per socket
+};
+
+struct config_t {
+    bool enabled;
+    const char * name;
+    uint64_t read_cyc;
+    uint64_t flush_cyc;
+    uint64_t fence_cyc;
+    uint64_t line_cyc;       // cycles to drain one cache line at the write bandwidth
+    uint64_t burst_cyc;      // how much the bucket may run ahead, the size of the DIMM write buffers
+    std::atomic<uint64_t> bw_next; // the TSC at which the next line may be written back
+};
+
+inline double tsc_per_ns() { // calibrate the TSC against the steady clock
+    static double ratio = 0;
+    if(ratio == 0) {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t c0 = __rdtsc();
+        while(std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(20));
+        uint64_t c1 = __rdtsc();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        ratio = (double)(c1 - c0) / ns;
+    }
+    return ratio;
+}
+
+inline void spin_until(uint64_t tsc) {
+    while(__rdtsc() < tsc) _mm_pause();
+}
+
+inline void delay(uint64_t cyc) {
+    spin_until(__rdtsc() + cyc);
+}
+
+} // namespace pmemu
+
+// the emulation settings, defined in tlbtree_impl.cc
+extern pmemu::config_t pmemu_cfg;
+
+/*
+ *  Enable the emulation with explicit parameters, all zero disables it
+ */
+inline void pmemu_configure(const pmemu::profile_t & p) {
+    double r = pmemu::tsc_per_ns();
+    pmemu_cfg.name = p.name;
+    pmemu_cfg.read_cyc = p.read_ns * r;
+    pmemu_cfg.flush_cyc = p.flush_ns * r;
+    pmemu_cfg.fence_cyc = p.fence_ns * r;
+    pmemu_cfg.line_cyc = p.write_mbps == 0 ? 0 : 64 * 1000.0 / p.write_mbps * r;
+    pmemu_cfg.burst_cyc = pmemu_cfg.line_cyc * 64; // 4KB of write buffers
+    pmemu_cfg.bw_next.store(0);
+    pmemu_cfg.enabled = p.read_ns || p.flush_ns || p.fence_ns || p.write_mbps;
+}
+
+/*
+ *  Enable the emulation with a named profile, "dram" disables it
+ *  return false if the profile is unknown
+ */
+inline bool pmemu_configure(const char * profile) {
+    for(auto & p : pmemu::PROFILES) {
+        if(strcmp(p.name, profile) == 0) {
+            pmemu_configure(p);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void pmemu_read(const void * addr, size_t len) { // charge reading [addr, addr + len) from PM
+    if(pmemu_cfg.enabled && pmemu_cfg.read_cyc) {
+        uint64_t xplines = (((uint64_t)addr + len - 1) >> 8) - ((uint64_t)addr >> 8) + 1;
+        pmemu::delay(xplines * pmemu_cfg.read_cyc);
+    }
+}
+
+inline void pmemu_flush() { // charge writing back one cache line
+    uint64_t now = __rdtsc();
+    uint64_t until = now + pmemu_cfg.flush_cyc;
+    if(pmemu_cfg.line_cyc) { // take a token from the bucket, or wait for one
+        uint64_t next = pmemu_cfg.bw_next.load(std::memory_order_relaxed), start;
+        do {
+            start = std::max(next, now - std::min(now, pmemu_cfg.burst_cyc));
+        } while(!pmemu_cfg.bw_next.compare_exchange_weak(next, start + pmemu_cfg.line_cyc, std::memory_order_relaxed));
+        until = std::max(until, start);
+    }
+    pmemu::spin_until(until);
+}
+
+inline void pmemu_fence() {
+    pmemu::delay(pmemu_cfg.fence_cyc);
+}
+
+#endif // __PMEMU_H__
@@ -0,0 +1,74 @@
+/*  radixsort.h - LSD radix sort for batches of records
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __RADIXSORT_H__
+#define __RADIXSORT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include "common.h"
+
+namespace radixsort {
+
+constexpr int RADIX_BITS = 8;
+constexpr int BUCKETS = 1 << RADIX_BITS;
+
+// map a signed key into an unsigned one with the same order
+inline uint64_t order_key(_key_t k) {
+    return (uint64_t)k ^ ((uint64_t)1 << 63);
+}
+
+/*
+    sort the records by key, 8 bits per pass. Passes in which all the keys
+    share the same digit are skipped, so dense key ranges cost fewer passes.
+*/
+inline void sort(std::vector<Record> & recs) {
+    if(!std::is_integral<_key_t>::value || sizeof(_key_t) != 8 || recs.size() < BUCKETS) {
+        std::sort(recs.begin(), recs.end());
+        return ;
+    }
+
+    size_t n = recs.size();
+    std::vector<Record> tmp(n);
+    Record * from = recs.data(), * to = tmp.data();
+
+    // count all the digits in one scan
+    size_t counts[sizeof(_key_t)][BUCKETS];
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < n; i++) {
+        uint64_t k = order_key(from[i].key);
+        for(int d = 0; d < (int)sizeof(_key_t); d++)
+            counts[d][(k >> (d * RADIX_BITS)) & (BUCKETS - 1)]++;
+    }
+
+    for(int d = 0; d < (int)sizeof(_key_t); d++) {
+        size_t * cnt = counts[d];
+        if(cnt[(order_key(from[0].key) >> (d * RADIX_BITS)) & (BUCKETS - 1)] == n)
+            continue; // every key has the same digit
+
+        size_t offset = 0;
+        for(int b = 0; b < BUCKETS; b++) {
+            size_t c = cnt[b];
+            cnt[b] = offset;
+            offset += c;
+        }
+        for(size_t i = 0; i < n; i++) {
+            uint64_t k = order_key(from[i].key);
+            to[cnt[(k >> (d * RADIX_BITS)) & (BUCKETS - 1)]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+
+    if(from != recs.data())
+        memcpy(recs.data(), from, n * sizeof(Record));
+}
+
+} // namespace radixsort
+
+#endif // __RADIXSORT_H__
@@ -0,0 +1,91 @@
+/*  rebuild_policy.h - when to rebuild the top layer
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __REBUILD_POLICY_H__
+#define __REBUILD_POLICY_H__
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+    What a policy sees each time TLBtreeImpl asks it, see TLBtreeImpl::maybe_rebuild().
+    Operations that walk no sibling chain do not ask.
+*/
+struct rebuild_state_t {
+    int      steps;          // sibling chain steps of the asking operation
+    uint64_t hops;           // sibling chain steps paid by all operations on the tree since the last rebuild
+    size_t   backlog;        // sub-index roots in mutable_, waiting for a rebuild
+    size_t   subroots;       // sub-index roots the next rebuild installs, estimated
+    double   last_cost_sec;  // duration of the last rebuild, 0 if there was none
+    size_t   last_subroots;  // sub-index roots installed by the last rebuild
+    double   since_last_sec; // since the last rebuild finished
+};
+
+/*
+    RebuildPolicy:
+        decides whether the asking operation starts a rebuild. It is called concurrently by
+        all the threads, so it must not keep mutable state.
+*/
+class RebuildPolicy {
+public:
+    virtual ~RebuildPolicy() {}
+    virtual const char * name() const = 0;
+    virtual bool should_rebuild(const rebuild_state_t & s) const = 0;
+};
+
+/*
+    StepRebuildPolicy:
+        the original trigger, any operation that walks more than threshold steps
+*/
+class StepRebuildPolicy : public RebuildPolicy {
+private:
+    int threshold_;
+
+public:
+    StepRebuildPolicy(int threshold): threshold_(threshold) {}
+
+    const char * name() const { return "step"; }
+
+    bool should_rebuild(const rebuild_state_t & s) const {
+        return s.steps > threshold_;
+    }
+};
+
+/*
+    CostRebuildPolicy:
+        a rebuild costs about as much as the last one, scaled by the sub-index roots it installs;
+        every sibling chain step costs one random read of a node, hop_ns. The steps paid since the
+        last rebuild are what a rebuild would have saved, so rebuild once they add up to the
+        rebuild cost (the ski-rental rule, never worse than twice the best schedule).
+        Two limits on top of it:
+          - rebuilds take at most 1 / (1 + gap) of the time, so a stream of sequential inserts,
+            which lengthens one chain fast, does not rebuild back to back
+          - an operation walking max_steps steps rebuilds regardless of the debt, once the gap
+            has passed, so a skewed read on a very long chain is not left waiting
+*/
+class CostRebuildPolicy : public RebuildPolicy {
+private:
+    double hop_ns_;
+    double gap_;
+    int max_steps_;
+
+    static constexpr double FIRST_NS_PER_SUBROOT = 100; // rebuild cost estimate before any rebuild
+
+public:
+    CostRebuildPolicy(double hop_ns = 300, double gap = 1, int max_steps = 64):
+        hop_ns_(hop_ns), gap_(gap), max_steps_(max_steps) {}
+
+    const char * name() const { return "cost"; }
+
+    bool should_rebuild(const rebuild_state_t & s) const {
+        double cost = s.last_cost_sec > 0 && s.last_subroots > 0 ?
+                        s.last_cost_sec * s.subroots / s.last_subroots : s.subroots * FIRST_NS_PER_SUBROOT / 1e9;
+        if(s.since_last_sec < s.last_cost_sec * gap_) return false;
+        if(s.steps >= max_steps_) return true;
+        return s.hops * hop_ns_ / 1e9 >= cost;
+    }
+};
+
+#endif // __REBUILD_POLICY_H__
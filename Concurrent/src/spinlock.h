@@ -8,6 +8,8 @@
 #include <emmintrin.h>
 #include <thread>
 
+#include "stats.h"
+
 class Spinlock {
 public:
     Spinlock() {
@@ -20,6 +22,7 @@ public:
 public:
     inline void lock() {
         while(atomic_val.exchange(1, std::memory_order_acquire) == 1){
+            stat_add(stats::LOCK_SPIN);
             while(1) {
                 _mm_pause(); // delay for 140 cycle
 
@@ -0,0 +1,129 @@
+/*  split_buffer.h - sub-index roots waiting for the next rebuild of the top layer
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __SPLIT_BUFFER_H__
+#define __SPLIT_BUFFER_H__
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "spinlock.h"
+#include "stats.h"
+
+/*
+    SplitBuffer:
+        the sub-index roots that did not enter the top layer, or were split off during a
+        rebuild. Each thread appends to the run of its counter slot, so a split storm takes no
+        shared lock and grows no shared vector; the lock of a run is only contended by the
+        drain of a rebuild, or by threads beyond stats::SHARDS sharing a shard.
+        drain() takes all the runs at once, sorts each of them and merges them.
+*/
+class SplitBuffer {
+private:
+    static const size_t RUN_RESERVE = 256;
+
+    struct run_t {
+        Spinlock mtx;
+        std::vector<Record> recs;
+        std::atomic<size_t> size;      // recs.size(), for readers without the lock
+    } __attribute__((aligned(64)));
+
+    run_t * runs_;
+
+public:
+    SplitBuffer(): runs_(new run_t[stats::SHARDS]) {
+        for(int i = 0; i < stats::SHARDS; i++) {
+            runs_[i].recs.reserve(RUN_RESERVE);
+            runs_[i].size.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~SplitBuffer() {
+        delete [] runs_;
+    }
+
+    SplitBuffer(const SplitBuffer &) = delete;
+    SplitBuffer & operator = (const SplitBuffer &) = delete;
+
+public:
+    void push(const Record & r) {
+        run_t & run = local_run();
+        run.mtx.lock();
+            run.recs.push_back(r);
+            run.size.store(run.recs.size(), std::memory_order_relaxed);
+        run.mtx.unlock();
+    }
+
+    void push(const std::vector<Record> & rs) {
+        if(rs.empty()) return;
+        run_t & run = local_run();
+        run.mtx.lock();
+            run.recs.insert(run.recs.end(), rs.begin(), rs.end());
+            run.size.store(run.recs.size(), std::memory_order_relaxed);
+        run.mtx.unlock();
+    }
+
+    size_t size() const { // racy
+        size_t cnt = 0;
+        for(int i = 0; i < stats::SHARDS; i++)
+            cnt += runs_[i].size.load(std::memory_order_relaxed);
+        return cnt;
+    }
+
+    void drain(std::vector<Record> & out) {
+        /* move all the records into out in key order, records pushed meanwhile are either
+            in out or left for the next drain */
+        std::vector<size_t> bounds = {out.size()};
+        for(int i = 0; i < stats::SHARDS; i++) {
+            if(runs_[i].size.load(std::memory_order_relaxed) == 0) continue;
+            std::vector<Record> fresh;
+            fresh.reserve(RUN_RESERVE);
+            runs_[i].mtx.lock();
+                runs_[i].recs.swap(fresh);
+                runs_[i].size.store(0, std::memory_order_relaxed);
+            runs_[i].mtx.unlock();
+
+            std::sort(fresh.begin(), fresh.end(), key_less);
+            out.insert(out.end(), fresh.begin(), fresh.end());
+            bounds.push_back(out.size());
+        }
+
+        // merge the sorted runs pairwise, doubling the width of a run each round
+        while(bounds.size() > 2) {
+            std::vector<size_t> merged = {bounds[0]};
+            for(size_t i = 0; i + 2 < bounds.size(); i += 2) {
+                std::inplace_merge(out.begin() + bounds[i], out.begin() + bounds[i + 1], out.begin() + bounds[i + 2], key_less);
+                merged.push_back(bounds[i + 2]);
+            }
+            if(bounds.size() % 2 == 0) merged.push_back(bounds.back()); // an odd run out
+            bounds.swap(merged);
+        }
+    }
+
+    template<typename F>
+    void remove_if(F pred) { // drop the records pred holds for
+        for(int i = 0; i < stats::SHARDS; i++) {
+            run_t & run = runs_[i];
+            run.mtx.lock();
+                run.recs.erase(std::remove_if(run.recs.begin(), run.recs.end(), pred), run.recs.end());
+                run.size.store(run.recs.size(), std::memory_order_relaxed);
+            run.mtx.unlock();
+        }
+    }
+
+private:
+    static bool key_less(const Record & a, const Record & b) {
+        return a.key < b.key;
+    }
+
+    run_t & local_run() { // the run of the calling thread is the one of its counter slot
+        return runs_[stat_slot()];
+    }
+};
+
+#endif // __SPLIT_BUFFER_H__
@@ -0,0 +1,99 @@
+/*  stats.h - operational counters of TLBtree, sharded per thread
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+
+/*
+    Statistic counters:
+        each tree owns a set of counters, split in cache-line aligned shards, one per thread
+        slot. A thread counts into the tree it works on (see stat_scope_t) with plain loads and
+        stores, so counting never bounces a cache line between cores. Readers sum all the
+        shards; the sum is not an atomic snapshot, which is fine for monitoring.
+        Threads beyond SHARDS share slots, and may then lose a few increments.
+*/
+namespace stats {
+
+const int GOES_BUCKETS = 8; // sibling chain steps 0, 1, ..., 6 and 7+
+
+enum Counter {
+    GOES_STEPS,                                   // histogram, GOES_BUCKETS counters
+    OLC_RETRY_CHILD = GOES_STEPS + GOES_BUCKETS,  // optimistic read retries in Node::get_child
+    OLC_RETRY_LEAF,                               // optimistic read retries in Fixtree::leaf_search
+    LATCH_SPIN,                                   // waits on a wotree256 node latch
+    LOCK_SPIN,                                    // waits on a Spinlock
+    UPTREE_INSERT_FAIL,                           // sub-index roots that do not fit in the top layer
+    REBUILD_FAST,
+    REBUILD_FAST_NS,
+    REBUILD_RECOVER,
+    REBUILD_RECOVER_NS,
+    CHAIN_HOPS,                                   // sibling chain steps of all operations
+    REBUILD_DEFERRED,                             // walks beyond REBUILD_THRESHOLD the policy did not rebuild on
+    NODE_MERGE,                                   // down layer nodes merged into their left neighbour
+    REBUILD_COMPACT,
+    REBUILD_COMPACT_NS,
+    SUBROOT_FREE,                                 // emptied sub-index trees unlinked by compaction
+    COUNTERS
+};
+
+const int SHARDS = 64;
+
+struct shard_t {
+    uint64_t c[COUNTERS];
+} __attribute__((aligned(64)));
+
+struct counters_t { // the counters of one tree
+    shard_t shards[SHARDS];
+    counters_t() { memset(shards, 0, sizeof(shards)); }
+};
+
+} // namespace stats
+
+// defined in tlbtree_impl.cc
+extern std::atomic<int> stat_next_shard;
+extern stats::counters_t stat_orphans;  // what is counted outside of any tree
+
+// the counters of the tree the calling thread works on
+inline thread_local stats::counters_t * stat_target = &stat_orphans;
+
+inline int stat_slot() { // the shard of the calling thread, in the counters of every tree
+    static thread_local int idx = -1;
+    if(idx < 0) idx = stat_next_shard.fetch_add(1, std::memory_order_relaxed) % stats::SHARDS;
+    return idx;
+}
+
+inline stats::shard_t & local_shard() {
+    return stat_target->shards[stat_slot()];
+}
+
+inline void stat_add(stats::Counter c, uint64_t v = 1) {
+    uint64_t * p = &local_shard().c[c];
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+inline void stat_goes(int steps) {
+    stat_add((stats::Counter)(stats::GOES_STEPS + (steps < stats::GOES_BUCKETS ? steps : stats::GOES_BUCKETS - 1)));
+    if(steps > 0) stat_add(stats::CHAIN_HOPS, steps);
+}
+
+inline uint64_t stat_sum(const stats::counters_t & cnt, int c) {
+    uint64_t sum = 0;
+    for(int i = 0; i < stats::SHARDS; i++)
+        sum += __atomic_load_n(&cnt.shards[i].c[c], __ATOMIC_RELAXED);
+    return sum;
+}
+
+// the calling thread counts into cnt until the scope ends, scopes nest
+struct stat_scope_t {
+    stats::counters_t * prev;
+    stat_scope_t(stats::counters_t & cnt): prev(stat_target) { stat_target = &cnt; }
+    ~stat_scope_t() { stat_target = prev; }
+};
+
+#endif // __STATS_H__
@@ -1,3 +1,11 @@
 #include "tlbtree_impl.h"
 
-PMAllocator * galc;
\ No newline at end of file
+FlushType flush_type = detect_flush_type();
+bool flush_elided = detect_eadr();
+bool use_ntstore = false;
+pmemu::config_t pmemu_cfg;
+bool meter_enabled = false;
+meter::registry_t meter_registry;
+stats::counters_t stat_orphans;
+std::atomic<int> stat_next_shard(0);
+EpochManager gepoch;
@@ -9,14 +9,19 @@
 #include <string>
 #include <thread>
 #include <algorithm>
+#include <atomic>
 #include <unistd.h>
 
 #include "pmallocator.h"
 #include "fixtree.h"
 #include "spinlock.h"
 #include "wotree256.h"
-
-extern PMAllocator * galc;
+#include "radixsort.h"
+#include "stats.h"
+#include "heat.h"
+#include "rebuild_policy.h"
+#include "epoch.h"
+#include "split_buffer.h"
 
 #define BACKGROUND_REBUILD
 // choose uptree type, providing interfaces: insert, remove, update, find, merge, free_uptree
@@ -30,10 +35,69 @@ using std::string;
 using std::vector;
 using Node = DOWNTREE_NS::Node;
 
+// counters and gauges of a TLBtree, see TLBtreeImpl::stats(). The counters are of this tree only,
+// counted since it was opened
+struct tlbtree_stats_t {
+    uint64_t goes_steps[stats::GOES_BUCKETS]; // histogram of sibling chain steps, the last bucket is 7+
+    uint64_t olc_retry_child;      // optimistic read retries in the down layer
+    uint64_t olc_retry_leaf;       // optimistic read retries in top layer leaves
+    uint64_t latch_spins;          // waits on down layer node latches
+    uint64_t lock_spins;           // waits on spinlocks (top layer leaves, allocator, runs of mutable_)
+    uint64_t uptree_insert_fails;  // sub-index roots that failed to enter the top layer
+    uint64_t rebuild_fast_cnt;
+    double   rebuild_fast_sec;     // total duration of fast rebuilds
+    uint64_t rebuild_recover_cnt;
+    double   rebuild_recover_sec;  // total duration of recover rebuilds
+    uint64_t rebuild_compact_cnt;
+    double   rebuild_compact_sec;  // total duration of compacting rebuilds
+    uint64_t subroots_freed;       // emptied sub-index trees unlinked and freed by compaction
+    const char * rebuild_policy;
+    uint64_t chain_hops;           // sibling chain steps of all operations
+    uint64_t rebuild_deferred;     // walks beyond REBUILD_THRESHOLD that did not rebuild
+    uint64_t subtrees_read_hot;    // heat table slots whose sub-index roots split at READ_HOT_ROOT_CARD
+    uint64_t node_merges;          // down layer nodes merged by deletes
+    // gauges
+    size_t   mutable_size;         // sub-index roots waiting for the next rebuild
+    uint64_t reclaim_pending;      // merged nodes and old top layers waiting for their readers to leave, of all the trees
+    uint32_t uptree_height;
+    uint32_t uptree_leaf_cnt;
+    double   uptree_leaf_fill;     // fraction of occupied slots in top layer leaves
+    uint32_t uptree_live;          // sub-index roots in the top layer
+    const char * flush_instruction;
+    const char * persist_domain;
+};
+
+// memory footprint of a TLBtree, see TLBtreeImpl::footprint()
+struct tlbtree_footprint_t {
+    // top layer, allocated as large objects of the pool
+    uint32_t uptree_inner_cnt;
+    uint64_t uptree_inner_bytes;
+    uint32_t uptree_leaf_cnt;
+    uint64_t uptree_leaf_bytes;
+    double   uptree_leaf_fill;
+    // down layer, levels are counted from the leaves (level 0)
+    uint64_t subroots;             // sub-index roots in the sibling chain
+    int      down_height;          // of the tallest sub-index tree
+    DOWNTREE_NS::level_usage_t down_levels[DOWNTREE_NS::MAX_LEVEL];
+    // blocks of the allocator
+    size_t   block_size;
+    size_t   used_blocks;          // meta_->cur_blk
+    size_t   max_blocks;
+    size_t   free_blocks;          // freed by merges and compaction, reused by the next allocations
+    size_t   reachable_blocks;     // down layer nodes and the entrance
+    size_t   unreachable_blocks;   // retired but not reclaimed yet, skipped at the end of pieces, or leaked by a restart
+    size_t   headroom_bytes;       // blocks left, unused or free, until malloc() runs out of them
+    size_t   large_headroom_bytes; // left for objects of 4KB or more, the top layer is allocated there
+};
+
 template<int DOWNLEVEL, int REBUILD_THRESHOLD=2>
 class TLBtreeImpl {
 private:
     typedef TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD> SelfType;
+    static const int READ_HOT_ROOT_CARD = DOWNTREE_NS::CARDINALITY / 2 + 1;
+    // compact once at least this fraction of the top layer leaves are sparse, wherever deletes
+    // emptied their sub-index trees: spread over the key range or all in one range of it
+    static constexpr double COMPACT_SPARSE = 0.25;
     
     // the entrance of TLBtree that stores its persistent tree metadata
     struct tlbtree_entrance_t {
@@ -45,15 +109,28 @@ private:
     };
     
     // volatile domain
+    PMAllocator * alc_;            // the pool of this tree, every node and top layer is allocated from it
     UPTREE_NS::uptree_t * uptree_;
     tlbtree_entrance_t * entrance_;
-    vector<Record> * mutable_;
+    SplitBuffer mutable_;          // sub-index roots waiting for the next rebuild
     Spinlock rebuild_mtx_;
-    Spinlock mutable_mtx_;
     bool is_rebuilding_;
+    HeatTable heat_;
+    // the inputs of policy_, see maybe_rebuild(), written by a rebuild while operations read them
+    RebuildPolicy * policy_;
+    std::atomic<uint64_t> hops_at_rebuild_; // CHAIN_HOPS of this tree when the last rebuild finished
+    std::atomic<double> last_rebuild_sec_;
+    std::atomic<double> last_rebuild_end_;
+    std::atomic<size_t> last_subroots_;
+    std::atomic<size_t> emptied_;  // sub-index trees removed from the top layer since the last compaction
+    mutable stats::counters_t counters_; // what the operations on this tree count, see stats()
 
 public:
-    TLBtreeImpl(string path, bool recover=true, uint64_t pool_size=10 * (1024UL * 1024 * 1024));
+    TLBtreeImpl(string path, bool recover=true, uint64_t pool_size=10 * (1024UL * 1024 * 1024))
+        : TLBtreeImpl(vector<string>{path}, recover, pool_size) {}
+
+    // one pool file per NUMA node, paths[i] on node i, threads allocate nodes from their local pool
+    TLBtreeImpl(const vector<string> & paths, bool recover, uint64_t pool_size);
 
     ~TLBtreeImpl();
 
@@ -65,24 +142,62 @@ public:
 
     bool remove(const _key_t & k);
 
+    int scan(const _key_t & start, int len, Record * out) const;
+
+    void ingest(vector<Record> & batch, int thread_cnt = std::thread::hardware_concurrency());
+
+    tlbtree_stats_t stats();
+
+    tlbtree_footprint_t footprint(); // walks the whole tree, call it without concurrent writers
+
+    // the footprint of a closed tree, its pools are mapped and walked without being written
+    static tlbtree_footprint_t footprint(const vector<string> & paths);
+
+    void set_rebuild_policy(RebuildPolicy * policy); // takes the ownership, call it before sharing the tree
+
     inline void printAll() { uptree_->printAll();}
 
+    PMAllocator * allocator() const { return alc_; }
+
 private:
+    int root_card(const Node * subroot) const;
+
+    void maybe_rebuild(int goes_steps);
+
+    void launch_rebuild();
+
+    void maybe_compact();
+
+    static tlbtree_footprint_t footprint_of(PMAllocator * alc, UPTREE_NS::uptree_t * uptree);
+
+    void rebuilt(double start, size_t subroots) { // reset the inputs of policy_ after a rebuild
+        double end = seconds();
+        last_rebuild_end_.store(end, std::memory_order_relaxed);
+        last_rebuild_sec_.store(end - start, std::memory_order_relaxed);
+        last_subroots_.store(subroots, std::memory_order_relaxed);
+        hops_at_rebuild_.store(stat_sum(counters_, stats::CHAIN_HOPS), std::memory_order_relaxed);
+    }
+
     void rebuild_fast();
 
     void rebuild_recover();
+
+    void rebuild_compact();
 };
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
-TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::TLBtreeImpl(string path, bool recover, uint64_t pool_size) {
-    mutable_ = new vector<Record>();
-    mutable_->reserve(0xfff);
-    bool is_rebuilding_ = false;
+TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::TLBtreeImpl(const vector<string> & paths, bool recover, uint64_t pool_size) {
+    is_rebuilding_ = false;
+    policy_ = new CostRebuildPolicy();
+    emptied_ = 0;
+    hops_at_rebuild_ = stat_sum(counters_, stats::CHAIN_HOPS);
+    last_rebuild_sec_ = 0;
+    last_rebuild_end_ = seconds();
     
     if(recover == false) {
-        galc = new PMAllocator(path.c_str(), false, "tlbtree", pool_size);
+        alc_ = new PMAllocator(paths, false, "tlbtree", pool_size);
         // initialize entrance_
-        entrance_ = (tlbtree_entrance_t *) galc->get_root(sizeof(tlbtree_entrance_t));
+        entrance_ = (tlbtree_entrance_t *) alc_->get_root(sizeof(tlbtree_entrance_t));
         entrance_->upent = NULL;
         entrance_->restore = NULL;
         entrance_->restore_size = 0;
@@ -91,14 +206,14 @@ TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::TLBtreeImpl(string path, bool recover
         clwb(entrance_, sizeof(tlbtree_entrance_t));
         
         //allocate a entrance_ to the fixtree
-        std::vector<Record> init = {Record(MIN_KEY, (char *)galc->relative(new Node()))}; 
-        uptree_ = new UPTREE_NS::uptree_t(init);
-        persist_assign(&(entrance_->upent), galc->relative(UPTREE_NS::get_entrance(uptree_)));
+        std::vector<Record> init = {Record(MIN_KEY, (char *)alc_->relative(::new (alc_->malloc(sizeof(Node))) Node()))}; 
+        uptree_ = new UPTREE_NS::uptree_t(alc_, init);
+        persist_assign(&(entrance_->upent), alc_->relative(UPTREE_NS::get_entrance(uptree_)));
         persist_assign(&(entrance_->use_rebuild_recover), false); // use fast rebuilding next time
     } else {
-        galc = new PMAllocator(path.c_str(), true, "tlbtree", pool_size);
+        alc_ = new PMAllocator(paths, true, "tlbtree", pool_size);
 
-        entrance_ = (tlbtree_entrance_t *) galc->get_root(sizeof(tlbtree_entrance_t));
+        entrance_ = (tlbtree_entrance_t *) alc_->get_root(sizeof(tlbtree_entrance_t));
         if(entrance_ == NULL || entrance_->upent == NULL) { // empty tree
             printf("the tree is empty\n");
             exit(-1);
@@ -109,35 +224,37 @@ TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::TLBtreeImpl(string path, bool recover
         } else { // normal shutdown
             // recover all subroots from PM back to mutable_, within miliseconds
             if(entrance_->restore != NULL) {
-                Record * rec = galc->absolute(entrance_->restore);
-                for(int i = 0; i < entrance_->restore_size; i++) {
-                    mutable_->push_back(rec[i]);
-                }
+                Record * rec = alc_->absolute(entrance_->restore);
+                mutable_.push(vector<Record>(rec, rec + entrance_->restore_size));
                 entrance_->restore = NULL;
                 entrance_->restore_size = 0;
                 clwb(&entrance_->restore, 16);
-                galc->free(rec);
+                alc_->free(rec);
             }
         }
 
-        uptree_ = new UPTREE_NS::uptree_t (galc->absolute(entrance_->upent));
+        uptree_ = new UPTREE_NS::uptree_t(alc_, alc_->absolute(entrance_->upent));
     }
+    last_subroots_ = (size_t)uptree_->leaf_cnt_ * UPTREE_NS::LEAF_REBUILD_CARD;
 
     persist_assign(&(entrance_->is_clean), false); // set the TLBtree state to be dirty
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::~TLBtreeImpl() {
+    rebuild_mtx_.lock(); // wait for a background rebuild
+    gepoch.synchronize(); // free the retired nodes and top layers while the allocator is alive
+
     if(entrance_->use_rebuild_recover == false) { // fast rebuilding next time
         // save all subroots in mutable_ into PM
-        Record * rec = (Record *) galc->malloc(std::max((size_t)4096, mutable_->size() * sizeof(Record)));
-        for(int i = 0; i < mutable_->size(); i++) {
-            rec[i] = (*mutable_)[i];
-        }
-        clwb(rec, mutable_->size() * sizeof(Record));
+        vector<Record> rest;
+        mutable_.drain(rest);
+        Record * rec = (Record *) alc_->malloc(std::max((size_t)4096, rest.size() * sizeof(Record)));
+        std::copy(rest.begin(), rest.end(), rec);
+        clwb(rec, rest.size() * sizeof(Record));
         mfence();
-        entrance_->restore = galc->relative(rec);
-        entrance_->restore_size = mutable_->size();
+        entrance_->restore = alc_->relative(rec);
+        entrance_->restore_size = rest.size();
         clwb(&entrance_->restore, 16);
     }
 
@@ -146,160 +263,473 @@ TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::~TLBtreeImpl() {
     persist_assign(&(entrance_->is_clean), true); // a intended shutdown
 
     delete uptree_;
-    delete mutable_;
-    delete galc;
+    delete policy_;
+    delete alc_;
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::insert(const _key_t & k, uint64_t v) { 
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::INSERT);
+    epoch_guard_t guard;
     Node ** root_ptr = (Node **)uptree_->find_lower(k);
-    Node * downroot = (Node *)galc->absolute(*root_ptr);
+    Node * downroot = (Node *)alc_->absolute(*root_ptr);
 
     // travese in sibling chain
-    int8_t goes_steps = 0;
+    int goes_steps = 0;
     _key_t splitkey; Node ** sibling_ptr;
     downroot->get_sibling(splitkey, sibling_ptr);
     while(splitkey < k) { // the splitkey 
         root_ptr = sibling_ptr; // where is current root store
-        downroot = (Node *)galc->absolute(*root_ptr);
+        downroot = (Node *)alc_->absolute(*root_ptr);
         downroot->get_sibling(splitkey, sibling_ptr);
         goes_steps += 1;
     }
-    res_t insert_res = DOWNTREE_NS::insert(root_ptr, k, v, DOWNLEVEL);
-
-    // we rebuild if the searching in the linklist is too long 
-    if(goes_steps > REBUILD_THRESHOLD && rebuild_mtx_.trylock()) {
-        if(entrance_->use_rebuild_recover == true) {
-            #ifdef BACKGROUND_REBUILD
-                std::thread rebuild_thread(&SelfType::rebuild_recover, this);
-                rebuild_thread.detach();
-            #else
-                rebuild_recover();
-            #endif
-        } else {
-            #ifdef BACKGROUND_REBUILD
-                std::thread rebuild_thread(&SelfType::rebuild_fast, this);
-                rebuild_thread.detach();
-            #else
-                rebuild_fast();
-            #endif
-        } 
-    }
+    stat_goes(goes_steps);
+    heat_.write(downroot);
+    res_t insert_res = DOWNTREE_NS::insert(alc_, root_ptr, k, v, DOWNLEVEL, root_card(downroot));
+
+    // we rebuild if the searching in the linklist costs too much
+    maybe_rebuild(goes_steps);
 
     if(insert_res.flag == true) { // a sub-index tree is splitted
         // try save the sub-indices root into the top layer
-        bool succ = uptree_->insert(insert_res.rec.key, (uint64_t)galc->relative(insert_res.rec.val));
+        meter_upinsert();
+        bool succ = uptree_->insert(insert_res.rec.key, (uint64_t)alc_->relative(insert_res.rec.val));
         
+        if(succ == false) stat_add(stats::UPTREE_INSERT_FAIL);
         // save these records into mutable_
-        if(is_rebuilding_ == true || succ == false) {
-            mutable_mtx_.lock();
-                mutable_->push_back({insert_res.rec.key, (char *)galc->relative(insert_res.rec.val)});
-            mutable_mtx_.unlock();
-        }
+        if(is_rebuilding_ == true || succ == false)
+            mutable_.push({insert_res.rec.key, (char *)alc_->relative(insert_res.rec.val)});
     }
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 bool TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::find(const _key_t & k, uint64_t & v) const {
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::READ);
+    epoch_guard_t guard;
     Node ** root_ptr = (Node **)uptree_->find_lower(k);
-    Node * downroot = (Node *)galc->absolute(*root_ptr);
+    Node * downroot = (Node *)alc_->absolute(*root_ptr);
 
     // traverse in sibling chain
+    int goes_steps = 0;
     _key_t splitkey; Node ** sibling_ptr;
     downroot->get_sibling(splitkey, sibling_ptr);
     while(splitkey <= k) { // the splitkey 
         root_ptr = sibling_ptr; // where is current root store
-        downroot = (Node *)galc->absolute(*root_ptr);
+        downroot = (Node *)alc_->absolute(*root_ptr);
         downroot->get_sibling(splitkey, sibling_ptr);
+        goes_steps += 1;
     }
+    stat_goes(goes_steps);
+    heat_.read(downroot);
+    const_cast<SelfType *>(this)->maybe_rebuild(goes_steps); // long chains slow down reads as well
 
-    return DOWNTREE_NS::find(root_ptr, k, v);
+    return DOWNTREE_NS::find(alc_, root_ptr, k, v);
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 bool TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::remove(const _key_t & k) {
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::DELETE);
+    bool emptyif;
+    { // a compaction waits for the operations in flight, it is started out of the critical section
+    epoch_guard_t guard;
     Node ** root_ptr = (Node **)uptree_->find_lower(k);
     Node ** last_root_ptr = NULL; // record the last root ptr for laster use
-    Node *downroot = (Node *)galc->absolute(*root_ptr);
+    Node *downroot = (Node *)alc_->absolute(*root_ptr);
 
     // travese in sibling chain
+    int goes_steps = 0;
     _key_t splitkey; Node ** sibling_ptr;
     downroot->get_sibling(splitkey, sibling_ptr);
     while(splitkey < k) { // the splitkey 
         root_ptr = sibling_ptr; // where is current root store
-        downroot = (Node *)galc->absolute(*root_ptr);
+        downroot = (Node *)alc_->absolute(*root_ptr);
         downroot->get_sibling(splitkey, sibling_ptr);
+        goes_steps += 1;
     }
+    stat_goes(goes_steps);
+    heat_.write(downroot);
+    maybe_rebuild(goes_steps);
     
-    bool emptyif = DOWNTREE_NS::remove(root_ptr, k);
-    if(emptyif) { // the DOWNTREE_NS is empty now
-        uptree_->try_remove(k); // TODO: rebuilding should also be triggered when the top layer is too empty
+    emptyif = DOWNTREE_NS::remove(alc_, root_ptr, k);
+    if(emptyif) { // the DOWNTREE_NS is empty now, stop routing to it
+        emptyif = uptree_->try_remove(k, (char *)*root_ptr); // counted once per tree
+        if(emptyif) emptied_.fetch_add(1, std::memory_order_relaxed);
+    }
     }
 
+    if(emptyif) maybe_compact(); // the emptied tree itself is freed by the compaction
     return true;
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 bool TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::update(const _key_t & k, const uint64_t & v) {
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::UPDATE);
+    epoch_guard_t guard;
     Node ** root_ptr = (Node **)uptree_->find_lower(k);
-    Node * downroot = (Node *)galc->absolute(*root_ptr);
+    Node * downroot = (Node *)alc_->absolute(*root_ptr);
 
     // travese in sibling chain
+    int goes_steps = 0;
     _key_t splitkey; Node ** sibling_ptr;
     downroot->get_sibling(splitkey, sibling_ptr);
     while(splitkey < k) { // the splitkey 
         root_ptr = sibling_ptr; // where is current root store
-        downroot = (Node *)galc->absolute(*root_ptr);
+        downroot = (Node *)alc_->absolute(*root_ptr);
         downroot->get_sibling(splitkey, sibling_ptr);
+        goes_steps += 1;
     }
+    stat_goes(goes_steps);
+    heat_.read(downroot); // an update changes no structure, it searches like a read
+    maybe_rebuild(goes_steps);
 
-    return DOWNTREE_NS::update(root_ptr, k, v);
+    return DOWNTREE_NS::update(alc_, root_ptr, k, v);
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+int TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::scan(const _key_t & start, int len, Record * out) const {
+    // copy at most len records no less than start into out in key order, return the number copied
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::READ);
+    epoch_guard_t guard;
+    Node ** root_ptr = (Node **)uptree_->find_lower(start);
+    Node * downroot = (Node *)alc_->absolute(*root_ptr);
+
+    // traverse in sibling chain
+    int goes_steps = 0;
+    _key_t splitkey; Node ** sibling_ptr;
+    downroot->get_sibling(splitkey, sibling_ptr);
+    while(splitkey <= start) {
+        root_ptr = sibling_ptr;
+        downroot = (Node *)alc_->absolute(*root_ptr);
+        downroot->get_sibling(splitkey, sibling_ptr);
+        goes_steps += 1;
+    }
+    stat_goes(goes_steps);
+    const_cast<SelfType *>(this)->maybe_rebuild(goes_steps);
+
+    return DOWNTREE_NS::scan(alc_, root_ptr, start, len, out);
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::ingest(vector<Record> & batch, int thread_cnt) {
+    // merge a large unsorted batch into the tree, the batch is sorted in place
+    if(batch.empty()) return ;
+    stat_scope_t stat_scope(counters_);
+    radixsort::sort(batch);
+
+    // hold the rebuild latch, so the top layer stays unchanged until we rebuild it at last
+    rebuild_mtx_.lock();
+
+    // partition the batch by sub-index trees
+    struct partition_t {
+        Node ** root_ptr;
+        size_t begin, end;
+    };
+    vector<partition_t> parts;
+    for(size_t i = 0; i < batch.size(); ) {
+        _key_t k = batch[i].key;
+        Node ** root_ptr = (Node **)uptree_->find_lower(k);
+        Node * downroot = (Node *)alc_->absolute(*root_ptr);
+
+        // travese in sibling chain
+        _key_t splitkey; Node ** sibling_ptr;
+        downroot->get_sibling(splitkey, sibling_ptr);
+        while(splitkey <= k) {
+            root_ptr = sibling_ptr;
+            downroot = (Node *)alc_->absolute(*root_ptr);
+            downroot->get_sibling(splitkey, sibling_ptr);
+        }
+
+        size_t j = std::lower_bound(batch.begin() + i, batch.end(), Record(splitkey)) - batch.begin();
+        parts.push_back({root_ptr, i, j});
+        i = j;
+    }
+
+    // each partition is applied to its own sub-index tree by one worker
+    std::atomic<size_t> next_part(0), split_cnt(0);
+    auto worker = [&]() {
+        stat_scope_t stat_scope(counters_);
+        epoch_guard_t guard;
+        vector<Record> splits;
+        size_t p;
+        while((p = next_part.fetch_add(1, std::memory_order_relaxed)) < parts.size()) {
+            Node ** root_ptr = parts[p].root_ptr;
+            size_t i = parts[p].begin, end = parts[p].end;
+            while(i < end) {
+                // the sub-index tree may split during ingestion, follow its sibling chain
+                _key_t splitkey; Node ** sibling_ptr;
+                alc_->absolute(*root_ptr)->get_sibling(splitkey, sibling_ptr);
+                while(splitkey <= batch[i].key) {
+                    root_ptr = sibling_ptr;
+                    alc_->absolute(*root_ptr)->get_sibling(splitkey, sibling_ptr);
+                }
+
+                res_t split(false, {0, NULL});
+                i += DOWNTREE_NS::insert_run(alc_, root_ptr, &batch[i], end - i, DOWNLEVEL, split);
+                if(split.flag == true) // defer the top layer insertion to rebuilding
+                    splits.push_back({split.rec.key, (char *)alc_->relative(split.rec.val)});
+            }
+        }
+
+        split_cnt += splits.size();
+        mutable_.push(splits);
+    };
+
+    thread_cnt = std::max(1, std::min(thread_cnt, (int)parts.size()));
+    vector<std::thread> workers;
+    for(int t = 1; t < thread_cnt; t++)
+        workers.emplace_back(worker);
+    worker();
+    for(auto & w : workers)
+        w.join();
+
+    // install all the new sub-index trees with one rebuild, which releases the rebuild latch
+    if(split_cnt == 0)
+        rebuild_mtx_.unlock();
+    else if(entrance_->use_rebuild_recover == true)
+        rebuild_recover();
+    else
+        rebuild_fast();
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+tlbtree_stats_t TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::stats() {
+    tlbtree_stats_t st;
+    for(int i = 0; i < stats::GOES_BUCKETS; i++)
+        st.goes_steps[i] = stat_sum(counters_, stats::GOES_STEPS + i);
+    st.olc_retry_child = stat_sum(counters_, stats::OLC_RETRY_CHILD);
+    st.olc_retry_leaf = stat_sum(counters_, stats::OLC_RETRY_LEAF);
+    st.latch_spins = stat_sum(counters_, stats::LATCH_SPIN);
+    st.lock_spins = stat_sum(counters_, stats::LOCK_SPIN);
+    st.uptree_insert_fails = stat_sum(counters_, stats::UPTREE_INSERT_FAIL);
+    st.rebuild_fast_cnt = stat_sum(counters_, stats::REBUILD_FAST);
+    st.rebuild_fast_sec = stat_sum(counters_, stats::REBUILD_FAST_NS) / 1e9;
+    st.rebuild_recover_cnt = stat_sum(counters_, stats::REBUILD_RECOVER);
+    st.rebuild_recover_sec = stat_sum(counters_, stats::REBUILD_RECOVER_NS) / 1e9;
+    st.rebuild_compact_cnt = stat_sum(counters_, stats::REBUILD_COMPACT);
+    st.rebuild_compact_sec = stat_sum(counters_, stats::REBUILD_COMPACT_NS) / 1e9;
+    st.subroots_freed = stat_sum(counters_, stats::SUBROOT_FREE);
+    st.subtrees_read_hot = heat_.census();
+    st.rebuild_policy = policy_->name();
+    st.chain_hops = stat_sum(counters_, stats::CHAIN_HOPS);
+    st.rebuild_deferred = stat_sum(counters_, stats::REBUILD_DEFERRED);
+    st.node_merges = stat_sum(counters_, stats::NODE_MERGE);
+    st.reclaim_pending = gepoch.pending();
+
+    st.mutable_size = mutable_.size();
+
+    // hold the rebuild latch, so the top layer is not freed while we scan it
+    rebuild_mtx_.lock();
+        st.uptree_height = uptree_->height_;
+        st.uptree_leaf_cnt = uptree_->leaf_cnt_;
+        st.uptree_leaf_fill = uptree_->leaf_fill();
+        st.uptree_live = uptree_->live_cnt_;
+    rebuild_mtx_.unlock();
+
+    st.flush_instruction = flush_name();
+    st.persist_domain = persist_domain_name();
+    return st;
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::set_rebuild_policy(RebuildPolicy * policy) {
+    delete policy_;
+    policy_ = policy;
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::maybe_rebuild(int goes_steps) {
+    // ask policy_ on every walk longer than REBUILD_THRESHOLD, and on one shorter walk out of 32,
+    // collecting the state costs a sum over all the counter shards
+    static thread_local uint32_t tick = 0;
+    if(goes_steps == 0 || (goes_steps <= REBUILD_THRESHOLD && ++tick % 32 != 0)) return;
+
+    rebuild_state_t s;
+    s.steps = goes_steps;
+    s.hops = stat_sum(counters_, stats::CHAIN_HOPS) - hops_at_rebuild_.load(std::memory_order_relaxed);
+    s.backlog = mutable_.size();
+    s.last_subroots = last_subroots_.load(std::memory_order_relaxed);
+    s.subroots = s.last_subroots + s.backlog;
+    s.last_cost_sec = last_rebuild_sec_.load(std::memory_order_relaxed);
+    s.since_last_sec = seconds() - last_rebuild_end_.load(std::memory_order_relaxed);
+
+    if(policy_->should_rebuild(s)) {
+        if(rebuild_mtx_.trylock()) launch_rebuild();
+    } else if(goes_steps > REBUILD_THRESHOLD) {
+        stat_add(stats::REBUILD_DEFERRED);
+    }
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::launch_rebuild() { // the caller holds rebuild_mtx_
+    if(entrance_->use_rebuild_recover == true) {
+        #ifdef BACKGROUND_REBUILD
+            std::thread rebuild_thread(&SelfType::rebuild_recover, this);
+            rebuild_thread.detach();
+        #else
+            rebuild_recover();
+        #endif
+    } else {
+        #ifdef BACKGROUND_REBUILD
+            std::thread rebuild_thread(&SelfType::rebuild_fast, this);
+            rebuild_thread.detach();
+        #else
+            rebuild_fast();
+        #endif
+    } 
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::maybe_compact() { // called out of a critical section
+    /* the top layer drops the slot of an emptied tree, but the tree stays in the sibling chains,
+        where the walks of its neighbours' keys step over it, until a compaction unlinks it */
+    // compact when enough of the top layer leaves are sparse, see COMPACT_SPARSE, and at least a leaf
+    // worth of trees were emptied since the last compaction, so a small tree whose only leaf is
+    // sparse does not compact on every delete
+    auto sparse = [this]() {
+        size_t emptied = emptied_.load(std::memory_order_relaxed);
+        size_t sparse_leaves = uptree_->sparse_cnt_.load(std::memory_order_relaxed);
+        return emptied >= UPTREE_NS::LEAF_REBUILD_CARD && sparse_leaves >= uptree_->leaf_cnt_ * COMPACT_SPARSE;
+    };
+    if(!sparse()) return;
+    if(!rebuild_mtx_.trylock()) return; // the next emptied tree tries again
+    if(!sparse()) { // a compaction has just finished
+        rebuild_mtx_.unlock();
+        return;
+    }
+
+    #ifdef BACKGROUND_REBUILD
+        std::thread rebuild_thread(&SelfType::rebuild_compact, this);
+        rebuild_thread.detach();
+    #else
+        rebuild_compact();
+    #endif
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+int TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::root_card(const Node * subroot) const {
+    /* the records a sub-index root holds before it splits into the top layer: read-hot
+        trees split at about half, so their ranges are resolved by the top layer sooner;
+        the others fill the root up, absorbing more splits in the down layer.
+        The height itself stays DOWNLEVEL for every sub-index tree: a root is linked both
+        from the top layer and from its predecessor's sibling, and can not be swapped for a taller root */
+    return heat_.heat(subroot) == HeatTable::READ_HOT ? READ_HOT_ROOT_CARD : DOWNTREE_NS::CARDINALITY;
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+tlbtree_footprint_t TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::footprint() {
+    tlbtree_footprint_t fp;
+
+    // hold the rebuild latch, so the top layer is not freed while we walk the tree
+    rebuild_mtx_.lock();
+    { epoch_guard_t guard; // and merged nodes are not freed either, taken after the latch a compaction waits with
+        fp = footprint_of(alc_, uptree_);
+    }
+    rebuild_mtx_.unlock();
+    return fp;
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+tlbtree_footprint_t TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::footprint(const vector<string> & paths) {
+    /* the constructor would mark the tree dirty and take its restore block, and the destructor
+        would store mutable_ again, so only the allocator is opened here */
+    PMAllocator * alc = new PMAllocator(paths, true, "tlbtree", 0);
+    tlbtree_entrance_t * entrance = (tlbtree_entrance_t *)alc->root();
+    if(entrance == NULL || entrance->upent == NULL) { // empty tree
+        printf("the tree is empty\n");
+        exit(-1);
+    }
+
+    UPTREE_NS::uptree_t * uptree = new UPTREE_NS::uptree_t(alc, alc->absolute(entrance->upent));
+    tlbtree_footprint_t fp = footprint_of(alc, uptree);
+
+    delete uptree;
+    delete alc;
+    return fp;
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+tlbtree_footprint_t TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::footprint_of(PMAllocator * alc, UPTREE_NS::uptree_t * uptree) {
+    tlbtree_footprint_t fp = tlbtree_footprint_t();
+    fp.uptree_inner_cnt = uptree->inner_cnt();
+    fp.uptree_inner_bytes = std::max((size_t)4096, fp.uptree_inner_cnt * sizeof(UPTREE_NS::Fixtree::INNode));
+    fp.uptree_leaf_cnt = uptree->leaf_cnt_;
+    fp.uptree_leaf_bytes = std::max((size_t)4096, fp.uptree_leaf_cnt * sizeof(UPTREE_NS::Fixtree::LFNode));
+    fp.uptree_leaf_fill = uptree->leaf_fill();
+
+    // visit every sub-index tree through the sibling chain, as rebuild_recover() does
+    _key_t split_key;
+    Node ** sibling_ptr = (Node **)uptree->find_first();
+    Node * cur_root = (Node *)alc->absolute(*sibling_ptr);
+    while (cur_root != NULL) {
+        fp.subroots += 1;
+        fp.down_height = std::max(fp.down_height, DOWNTREE_NS::footprint(alc, sibling_ptr, fp.down_levels));
+        cur_root->get_sibling(split_key, sibling_ptr);
+        cur_root = alc->absolute(*sibling_ptr);
+    }
+
+    fp.block_size = PMAllocator::block_size();
+    fp.used_blocks = alc->used_blocks();
+    fp.max_blocks = alc->max_blocks();
+    fp.free_blocks = alc->free_blocks();
+    auto blocks = [&](size_t size) { return (size + fp.block_size - 1) / fp.block_size; };
+    fp.reachable_blocks = blocks(sizeof(tlbtree_entrance_t));
+    for(int l = 0; l < fp.down_height; l++)
+        fp.reachable_blocks += fp.down_levels[l].nodes * blocks(sizeof(Node));
+    fp.unreachable_blocks = fp.used_blocks - std::min(fp.used_blocks, fp.reachable_blocks + fp.free_blocks);
+    fp.headroom_bytes = (fp.max_blocks - fp.used_blocks + fp.free_blocks) * fp.block_size;
+    fp.large_headroom_bytes = alc->large_headroom();
+    return fp;
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::rebuild_fast() { // fast rebuilding function
-    // switch the restore to be immutable
-    vector<Record> * new_mutable = new vector<Record>;
-    new_mutable->reserve(0xffff);
-    
-    mutable_mtx_.lock();
-        vector<Record> * immutable = mutable_; // make the restore vector be immutable
-        mutable_ = new_mutable; // before this line, the mutable_ is still the old one
-    mutable_mtx_.unlock();
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::REBUILD);
+    double start = seconds();
+    // take the sorted runs of mutable_ as one immutable sorted vector, later splits stay in mutable_
+    vector<Record> immutable;
+    mutable_.drain(immutable);
 
     is_rebuilding_ = true;
 
-    std::sort(immutable->begin(), immutable->end());
     // get the snapshot of all sub-index trees by combining the top layer with immutable
     std::vector<Record> subroots;
     subroots.reserve(0x2ffff);
-    uptree_->merge(*immutable, subroots);
+    uptree_->merge(immutable, subroots);
 
     /* rebuild the top layer with immutable */  
     UPTREE_NS::uptree_t * old_tree = uptree_;
-    UPTREE_NS::entrance_t * old_upent = galc->absolute(entrance_->upent);
-    UPTREE_NS::uptree_t * new_tree = new UPTREE_NS::uptree_t(subroots);
+    UPTREE_NS::entrance_t * old_upent = alc_->absolute(entrance_->upent);
+    UPTREE_NS::uptree_t * new_tree = new UPTREE_NS::uptree_t(alc_, subroots);
     UPTREE_NS::entrance_t * new_upent = UPTREE_NS::get_entrance(new_tree);
     
     // install the new top layer
-    persist_assign(&(entrance_->upent), galc->relative(new_upent));
+    persist_assign(&(entrance_->upent), alc_->relative(new_upent));
     uptree_ = new_tree;
     
-    /* free the old top layer */
-    #ifdef BACKGROUND_REBUILD
-        usleep(50); // TODO: unsafe memory reclamation
-    #endif
-    UPTREE_NS::free(old_tree); // free the old_tree
+    /* free the old top layer once no operation is searching it */
+    gepoch.retire([old_tree]() { UPTREE_NS::free(old_tree); });
+    gepoch.collect(); // the top layers retired by earlier rebuilds are freed here, mostly
 
+    stat_add(stats::REBUILD_FAST);
+    stat_add(stats::REBUILD_FAST_NS, (seconds() - start) * 1e9);
+    rebuilt(start, subroots.size());
     is_rebuilding_ = false;
     asm volatile("" ::: "memory");
     rebuild_mtx_.unlock();
-
-    delete immutable;
 }
 
 template<int DOWNLEVEL, int REBUILD_THRESHOLD>
 void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::rebuild_recover() { // slow rebuilding function 
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::REBUILD);
+    double start = seconds();
     is_rebuilding_ = true;
     // get the snapshot of all sub-index trees by traverse in the down layer
     std::vector<Record> subroots;
@@ -307,35 +737,114 @@ void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::rebuild_recover() { // slow rebu
     
     _key_t split_key = 0; 
     Node ** sibling_ptr = (Node **)uptree_->find_first();
-    Node * cur_root = (Node *)galc->absolute(*sibling_ptr);
+    Node * cur_root = (Node *)alc_->absolute(*sibling_ptr);
     while (cur_root != NULL) {
         subroots.emplace_back(split_key, (char *)(*sibling_ptr));
         // get next sibling
         cur_root->get_sibling(split_key, sibling_ptr);
-        cur_root = galc->absolute(*sibling_ptr);
+        cur_root = alc_->absolute(*sibling_ptr);
     }
 
     /* rebuild the top layer with immutable */  
     UPTREE_NS::uptree_t * old_tree = uptree_;
-    UPTREE_NS::entrance_t * old_upent = galc->absolute(entrance_->upent);
-    UPTREE_NS::uptree_t * new_tree = new UPTREE_NS::uptree_t(subroots);
+    UPTREE_NS::entrance_t * old_upent = alc_->absolute(entrance_->upent);
+    UPTREE_NS::uptree_t * new_tree = new UPTREE_NS::uptree_t(alc_, subroots);
     UPTREE_NS::entrance_t * new_upent = UPTREE_NS::get_entrance(new_tree);
     
     // install the new top layer
-    persist_assign(&(entrance_->upent), galc->relative(new_upent));
+    persist_assign(&(entrance_->upent), alc_->relative(new_upent));
     uptree_ = new_tree;
     
-    /* free the old top layer */
-    #ifdef BACKGROUND_REBUILD
-        usleep(50); // TODO: unsafe memory reclamation
-    #endif
-    UPTREE_NS::free(old_tree); // free the old_tree
-
+    /* free the old top layer once no operation is searching it */
+    gepoch.retire([old_tree]() { UPTREE_NS::free(old_tree); });
+    gepoch.collect(); // the top layers retired by earlier rebuilds are freed here, mostly
+
+    stat_add(stats::REBUILD_RECOVER);
+    stat_add(stats::REBUILD_RECOVER_NS, (seconds() - start) * 1e9);
+    rebuilt(start, subroots.size());
+    // still under the latch, the destructor waits on it before unmapping the pool
+    persist_assign(&(entrance_->use_rebuild_recover), false); // use fast rebuilding next time
     is_rebuilding_ = false;
     asm volatile("" ::: "memory");
     rebuild_mtx_.unlock();
+}
 
-    persist_assign(&(entrance_->use_rebuild_recover), false); // use fast rebuilding next time
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+void TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>::rebuild_compact() { // rebuilding that drops emptied sub-index trees
+    stat_scope_t stat_scope(counters_);
+    meter_scope_t meter_scope(meter::REBUILD);
+    double start = seconds();
+    /* the walk below finds every sub-index root, including those waiting in mutable_, and
+        installs them. Their records are dropped, not kept for the next rebuild: if a tree is
+        emptied meanwhile, try_remove() clears its slot, and a stale record would bring it back */
+    mutable_.remove_if([](const Record &) { return true; });
+
+    is_rebuilding_ = true;
+    emptied_ = 0; // the trees emptied from here on may be passed by the walk
+
+    /* get the snapshot of the non-empty sub-index trees by traverse in the down layer, as
+        rebuild_recover() does, unlinking the empty ones from the sibling chains on the way.
+        The first tree stays even if it is empty, the top layer starts with it */
+    std::vector<Record> subroots;
+    subroots.reserve(0x2ffff);
+    std::vector<Node *> dropped;
+    Node * path[DOWNTREE_NS::MAX_LEVEL];
+
+    _key_t split_key = MIN_KEY;
+    Node ** sibling_ptr = (Node **)uptree_->find_first();
+    Node * prev_root = NULL;
+    Node * cur_root = (Node *)alc_->absolute(*sibling_ptr);
+    while (cur_root != NULL) {
+        int h = 0;
+        if(prev_root != NULL && DOWNTREE_NS::empty(alc_, sibling_ptr))
+            h = DOWNTREE_NS::unlink(alc_, prev_root, cur_root, path);
+        if(h > 0) {
+            dropped.insert(dropped.end(), path, path + h);
+            stat_add(stats::SUBROOT_FREE);
+            prev_root->get_sibling(split_key, sibling_ptr); // now past cur_root
+        } else {
+            subroots.emplace_back(split_key, (char *)(*sibling_ptr));
+            prev_root = cur_root;
+            cur_root->get_sibling(split_key, sibling_ptr);
+        }
+        cur_root = alc_->absolute(*sibling_ptr);
+    }
+
+    /* rebuild the top layer without the emptied trees */
+    UPTREE_NS::uptree_t * old_tree = uptree_;
+    UPTREE_NS::uptree_t * new_tree = new UPTREE_NS::uptree_t(alc_, subroots);
+    UPTREE_NS::entrance_t * new_upent = UPTREE_NS::get_entrance(new_tree);
+
+    // install the new top layer
+    persist_assign(&(entrance_->upent), alc_->relative(new_upent));
+    uptree_ = new_tree;
+
+    gepoch.retire([old_tree]() { UPTREE_NS::free(old_tree); });
+    is_rebuilding_ = false;
+    asm volatile("" ::: "memory");
+
+    /* an operation in flight may still reach an unlinked tree through the old top layer, or be
+        about to save one it split off into mutable_. Once they are gone, nothing but mutable_
+        refers to the unlinked trees, drop them from it and free them.
+        No rebuild runs meanwhile, so mutable_ is not installed before it is cleaned */
+    if(!dropped.empty()) {
+        gepoch.barrier();
+        std::sort(dropped.begin(), dropped.end());
+        auto is_dropped = [&](const Record & r) {
+            return std::binary_search(dropped.begin(), dropped.end(), (Node *)alc_->absolute(r.val));
+        };
+        mutable_.remove_if(is_dropped);
+
+        for(Node * n : dropped)
+            alc_->free(n);
+    }
+    gepoch.collect();
+
+    stat_add(stats::REBUILD_COMPACT);
+    stat_add(stats::REBUILD_COMPACT_NS, (seconds() - start) * 1e9);
+    rebuilt(start, subroots.size());
+    persist_assign(&(entrance_->use_rebuild_recover), false); // the walk did what a recover rebuilding does
+    rebuild_mtx_.unlock();
 }
 
 } // tlbtree namespace
@@ -2,66 +2,58 @@
 
 namespace wotree256 {
 
-bool insert_recursive(Node * n, _key_t k, uint64_t v, _key_t &split_k, Node * &split_node, int8_t &level) {
+bool insert_recursive(PMAllocator * alc, Node * n, _key_t k, uint64_t v, _key_t &split_k, Node * &split_node, int8_t &level, int8_t card) {
+    // card applies to n only, the nodes below split when full
     if(n->leftmost_ptr_ == NULL) {
-        return n->store(k, v, split_k, split_node);
+        return n->store(alc, k, v, split_k, split_node, card);
     } else {
         level++;
-        Node * child = (Node *) galc->absolute(n->get_child(k));
+        Node * child = (Node *) alc->absolute(n->get_child(alc, k));
         
         _key_t split_k_child;
         Node * split_node_child;
-        bool splitIf = insert_recursive(child, k, v, split_k_child, split_node_child, level);
+        bool splitIf = insert_recursive(alc, child, k, v, split_k_child, split_node_child, level);
 
         if(splitIf) { 
-            return n->store(split_k_child, (uint64_t)galc->relative(split_node_child), split_k, split_node);
+            return n->store(alc, split_k_child, (uint64_t)alc->relative(split_node_child), split_k, split_node, card);
         } 
         return false;
     }
 }
 
-bool remove_recursive(Node * n, _key_t k) {
+static void retire(PMAllocator * alc, Node * dead) {
+    // readers may still be on a merged node, it is freed after they are gone, to its own pool
+    if(dead != NULL) gepoch.retire([alc, dead]() { alc->free(dead); });
+}
+
+bool remove_recursive(PMAllocator * alc, Node * n, _key_t k) {
     if(n->leftmost_ptr_ == NULL) {
-        n->remove(k);
+        n->remove(alc, k);
         return n->state_.unpack.count < UNDERFLOW_CARD;
     }
     else {
-        Node * child = (Node *) galc->absolute(n->get_child(k));
-
-        bool shouldMrg = remove_recursive(child, k);
-
-        if(shouldMrg) {
-            Node *leftsib = NULL, *rightsib = NULL;
-            n->get_lrchild(k, leftsib, rightsib);
-
-            if(leftsib != NULL && (child->state_.unpack.count + leftsib->state_.unpack.count) < CARDINALITY) {
-                // merge with left node
-                int8_t slotid = child->state_.read(0);
-                n->remove(child->recs_[slotid].key);
-                Node::merge(leftsib, child);
+        Node * child = (Node *) alc->absolute(n->get_child(alc, k));
 
-                return n->state_.unpack.count < UNDERFLOW_CARD;
-            } else if (rightsib != NULL && (child->state_.unpack.count + rightsib->state_.unpack.count) < CARDINALITY) {
-                // merge with right node
-                int8_t slotid = rightsib->state_.read(0);
-                n->remove(rightsib->recs_[slotid].key);
-                Node::merge(child, rightsib);
+        bool shouldMrg = remove_recursive(alc, child, k);
 
-                return n->state_.unpack.count < UNDERFLOW_CARD;
-            }
+        if(shouldMrg) { // the merge decides again under the latches, the counts read here may be stale
+            Node * dead;
+            bool underflow = n->merge_child(alc, k, dead);
+            retire(alc, dead);
+            return underflow;
         }
         return false;
     }
 }
 
-bool find(Node ** rootPtr, _key_t key, uint64_t &val) {
-    Node * cur = galc->absolute(*rootPtr);
+bool find(PMAllocator * alc, Node ** rootPtr, _key_t key, uint64_t &val) {
+    Node * cur = alc->absolute(*rootPtr);
     while(cur->leftmost_ptr_ != NULL) { // no prefetch here
-        char * child_ptr = cur->get_child(key);
-        cur = (Node *)galc->absolute(child_ptr);
+        char * child_ptr = cur->get_child(alc, key);
+        cur = (Node *)alc->absolute(child_ptr);
     }
 
-    val = (uint64_t) cur->get_child(key);
+    val = (uint64_t) cur->get_child(alc, key);
 
     if((char *)val == NULL)
         return false;
@@ -69,25 +61,33 @@ bool find(Node ** rootPtr, _key_t key, uint64_t &val) {
         return true;
 }
 
-res_t insert(Node ** rootPtr, _key_t key, uint64_t val, int threshold) {
-    Node *root_= galc->absolute(*rootPtr);
+res_t insert(PMAllocator * alc, Node ** rootPtr, _key_t key, uint64_t val, int threshold, int8_t root_card) {
+    Node *root_= alc->absolute(*rootPtr);
     
     int8_t level = 1;
     _key_t split_k;
     Node * split_node;
-    bool splitIf = insert_recursive(root_, key, val, split_k, split_node, level);
+    bool splitIf = insert_recursive(alc, root_, key, val, split_k, split_node, level, root_card);
 
     if(splitIf) {
         if(level < threshold) {
-            Node *new_root = new Node;
-            new_root->leftmost_ptr_ = (char *)galc->relative(root_);
-            new_root->append({split_k, (char *)galc->relative(split_node)}, 0, 0);
-            new_root->state_.unpack.count = 1;
+            Node *new_root = (Node *)alc->malloc(sizeof(Node));
+            Node img;
+            img.leftmost_ptr_ = (char *)alc->relative(root_);
+            img.append({split_k, (char *)alc->relative(split_node)}, 0, 0);
+            img.state_.unpack.count = 1;
 
-            clwb(new_root, 64);
+            PersistBatch & pb = PersistBatch::local();
+            if(use_ntstore) {
+                ntstore(new_root, &img, 64);
+            } else {
+                memcpy(new_root, &img, 64);
+                pb.add(new_root, 64);
+            }
 
-            mfence(); // a barrier to make sure the new node is persisted
-            persist_assign(rootPtr, (Node *)galc->relative(new_root));
+            pb.fence(); // a barrier to make sure the new node is persisted
+            pb.assign(rootPtr, (Node *)alc->relative(new_root));
+            pb.flush();
 
             return res_t(false, {0, NULL});
         } else {
@@ -99,62 +99,165 @@ res_t insert(Node ** rootPtr, _key_t key, uint64_t val, int threshold) {
     }
 }
 
-bool update(Node ** rootPtr, _key_t key, uint64_t val) {
-    Node * cur = galc->absolute(*rootPtr);
+int insert_run(PMAllocator * alc, Node ** rootPtr, const Record * recs, int n, int threshold, res_t & split) {
+    // insert the leading records of a sorted run that fall into the same leaf
+    Node * cur = alc->absolute(*rootPtr);
+    _key_t upper = MAX_KEY;
+    while(cur->leftmost_ptr_ != NULL) {
+        char * child_ptr = cur->get_child(alc, recs[0].key, upper);
+        cur = (Node *)alc->absolute(child_ptr);
+    }
+
+    int cnt = cur->store_run(alc, recs, n, upper);
+    if(cnt > 0) {
+        split = res_t(false, {0, NULL});
+        return cnt;
+    }
+
+    // the leaf is full, split it by a normal insertion
+    split = insert(alc, rootPtr, recs[0].key, (uint64_t)recs[0].val, threshold);
+    return 1;
+}
+
+bool update(PMAllocator * alc, Node ** rootPtr, _key_t key, uint64_t val) {
+    Node * cur = alc->absolute(*rootPtr);
     while(cur->leftmost_ptr_ != NULL) { // no prefetch here
-        char * child_ptr = cur->get_child(key);
-        cur = (Node *)galc->absolute(child_ptr);
+        char * child_ptr = cur->get_child(alc, key);
+        cur = (Node *)alc->absolute(child_ptr);
     }
 
-    val = (uint64_t) cur->update(key, val);
+    val = (uint64_t) cur->update(alc, key, val);
     return true;
 }
 
-bool remove(Node ** rootPtr, _key_t key) {   
-    Node *root_= galc->absolute(*rootPtr);
-    if(root_->leftmost_ptr_ == NULL) {
-        root_->remove(key);
+int scan(PMAllocator * alc, Node ** rootPtr, _key_t start, int len, Record * out) {
+    Node * cur = alc->absolute(*rootPtr);
+    while(cur->leftmost_ptr_ != NULL) {
+        char * child_ptr = cur->get_child(alc, start);
+        cur = (Node *)alc->absolute(child_ptr);
+    }
 
-        return root_->state_.unpack.count == 0;
+    // the leaves of all the sub-indexes are chained by their siblings, in key order
+    int cnt = 0;
+    bool back = false; // cur was reached from a merged leaf, which forwards to its left neighbour
+    while(cur != NULL && cnt < len) {
+        Node * next;
+        bool forward;
+        int got = cur->scan(alc, start, len - cnt, out + cnt, next, forward);
+        if(back) { // skip the records copied from cur already, equal keys of other leaves are kept
+            int skip = 0;
+            while(cnt > 0 && skip < got && out[cnt + skip].key <= out[cnt - 1].key)
+                skip++;
+            if(skip > 0) std::copy(out + cnt + skip, out + cnt + got, out + cnt);
+            got -= skip;
+        }
+        cnt += got;
+        back = forward;
+        cur = next;
+    }
+    return cnt;
+}
+
+bool remove(PMAllocator * alc, Node ** rootPtr, _key_t key) {   
+    Node *root_= alc->absolute(*rootPtr);
+    if(root_->leftmost_ptr_ == NULL) {
+        root_->remove(alc, key);
     }
     else {
-        Node * child = (Node *) galc->absolute(root_->get_child(key));
-
-        bool shouldMrg = remove_recursive(child, key);
-
-        if(shouldMrg) {
-            Node *leftsib = NULL, *rightsib = NULL;
-            root_->get_lrchild(key, leftsib, rightsib);
-
-            if(leftsib != NULL && (child->state_.unpack.count + leftsib->state_.unpack.count) < CARDINALITY) {
-                // merge with left node
-                int8_t slotid = child->state_.read(0);
-                root_->remove(child->recs_[slotid].key);
-                Node::merge(leftsib, child);
-            } 
-            else if (rightsib != NULL && (child->state_.unpack.count + rightsib->state_.unpack.count) < CARDINALITY) {
-                // merge with right node
-                int8_t slotid = rightsib->state_.read(0);
-                root_->remove(rightsib->recs_[slotid].key);
-                Node::merge(child, rightsib);
-            }
-            
-            if(root_->state_.unpack.count == 0) { // the root is empty
-                Node * old_root = root_;
+        /* the root is never merged nor collapsed, even when it is left with leftmost_ptr_ only:
+            it is also linked by the sibling of the previous sub-index root, and all the linked
+            roots keep the same height. An emptied tree is unlinked as a whole, see unlink() */
+        remove_recursive(alc, root_, key);
+    } 
+    return empty(alc, rootPtr);
+}
 
-                persist_assign(rootPtr, (Node *)root_->leftmost_ptr_);
+bool empty(PMAllocator * alc, Node ** rootPtr) { // whether the sub-index tree holds no record, without latches
+    Node * cur = alc->absolute(*rootPtr);
+    while(cur->state_.unpack.count == 0 && cur->leftmost_ptr_ != NULL)
+        cur = (Node *)alc->absolute(cur->leftmost_ptr_);
+    return cur->state_.unpack.count == 0 && cur->leftmost_ptr_ == NULL;
+}
 
-                galc->free(old_root);
-            }
+int unlink(PMAllocator * alc, Node * prev, Node * root, Node ** path) {
+    /* unlink the empty sub-index tree of root from the sibling chains, prev is the sub-index
+        root before it. An empty tree is a path of empty nodes down from root, each level of it
+        is skipped by the rightmost node of prev's tree on that level. Latches are taken top down
+        and left to right like merges do, and the path is checked to be empty under them.
+        return the height of the tree, whose nodes are stored to path, or 0 if it is not empty */
+    Node * left[MAX_LEVEL];
+    int h = 0;
+    bool ok = true;
+    Node * l = prev, * r = root;
+    while(true) {
+        l->state_.lock();
+        r->state_.lock();
+        left[h] = l; path[h] = r; h++;
+
+        Record & sibling = l->siblings_[l->state_.unpack.sibling_version];
+        if((Node *)alc->absolute(sibling.val) != r || r->state_.unpack.count != 0
+            || (l->leftmost_ptr_ == NULL) != (r->leftmost_ptr_ == NULL)) {
+            ok = false;
+            break;
         }
+        if(r->leftmost_ptr_ == NULL) break;
+        l = (Node *)alc->absolute(l->child_at(l->state_.unpack.count));
+        r = (Node *)alc->absolute(r->leftmost_ptr_);
+    }
 
-        return false;
-    } 
+    if(ok) {
+        PersistBatch & pb = PersistBatch::local();
+        /* bottom up, so after a crash the upper levels still reach the empty nodes the lower
+            levels skip, and an empty tree still routes its keys to empty leaves */
+        for(int i = h - 1; i >= 0; i--) {
+            state_t st = left[i]->state_;
+            left[i]->siblings_[(st.unpack.sibling_version + 1) % 2] = path[i]->siblings_[path[i]->state_.unpack.sibling_version];
+            pb.add(&left[i]->siblings_[(st.unpack.sibling_version + 1) % 2], sizeof(Record));
+            pb.fence();
+            st.unpack.sibling_version = (st.unpack.sibling_version + 1) % 2;
+            pb.assign(&(left[i]->state_.pack), st.pack);
+            pb.fence();
+        }
+        // then every node of the path forwards to its left neighbour, as a merged node does
+        for(int i = h - 1; i >= 0; i--) {
+            state_t st = path[i]->state_;
+            path[i]->siblings_[(st.unpack.sibling_version + 1) % 2] = {MIN_KEY, (char *)alc->relative(left[i])};
+            pb.add(&path[i]->siblings_[(st.unpack.sibling_version + 1) % 2], sizeof(Record));
+            pb.fence();
+            st.unpack.sibling_version = (st.unpack.sibling_version + 1) % 2;
+            pb.assign(&(path[i]->state_.pack), st.pack);
+        }
+        pb.flush();
+    }
+
+    for(int i = h - 1; i >= 0; i--) {
+        path[i]->state_.unlock();
+        left[i]->state_.unlock();
+    }
+    return ok ? h : 0;
+}
+
+static int footprint_recursive(PMAllocator * alc, Node * n, level_usage_t * levels) {
+    int level = 0;
+    if(n->leftmost_ptr_ != NULL) {
+        level = footprint_recursive(alc, (Node *)alc->absolute(n->leftmost_ptr_), levels);
+        for(int i = 0; i < n->state_.unpack.count; i++)
+            footprint_recursive(alc, (Node *)alc->absolute(n->recs_[n->state_.read(i)].val), levels);
+        level += 1;
+    }
+    levels[level].nodes += 1;
+    levels[level].records += n->state_.unpack.count;
+    return level;
+}
+
+int footprint(PMAllocator * alc, Node ** rootPtr, level_usage_t * levels) { // levels are counted from the leaves, return the height
+    Node *root= alc->absolute(*rootPtr);
+    return footprint_recursive(alc, root, levels) + 1;
 }
 
-void printAll(Node ** rootPtr) {
-    Node *root= galc->absolute(*rootPtr);
-    root->print("", true);
+void printAll(PMAllocator * alc, Node ** rootPtr) {
+    Node *root= alc->absolute(*rootPtr);
+    root->print(alc, "", true);
 }
 
 } // namespace wotree256
\ No newline at end of file
@@ -11,9 +11,14 @@
 #include <string>
 #include <cstdio>
 #include <thread>
+#include <algorithm>
+#include <new>
 
 #include "flush.h"
+#include "persist_batch.h"
 #include "pmallocator.h"
+#include "stats.h"
+#include "epoch.h"
 
 namespace wotree256 {
 
@@ -22,6 +27,12 @@ inline void barrier() { __asm__ __volatile__("": : :"memory");}
 using std::string;
 constexpr int CARDINALITY = 13;
 constexpr int UNDERFLOW_CARD = 4;
+constexpr int MAX_LEVEL = 16;
+
+struct level_usage_t { // the nodes of one level and the records they hold
+    uint64_t nodes;
+    uint64_t records;
+};
 
 struct state_t {
     struct statefield_t { // totally 8 bytes
@@ -67,6 +78,7 @@ public:
         while(!__atomic_compare_exchange(&(this->pack), &old, &desired,
                 false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)){
             // the latch is hold by other thread or the state is changed
+            stat_add(stats::LATCH_SPIN);
             while(1) { // if the latch is not released, wait it
                 _mm_pause(); // delay for 140 cycle
                 if(unpack.latch == 0) // check if the latch is released
@@ -147,74 +159,93 @@ public:
         siblings_[1] = {MAX_KEY, NULL};
     }
 
-    void *operator new(size_t size) {
-        void * ret = galc->malloc(size);
-        return ret;
-    }
-
-    bool store(_key_t k, uint64_t v, _key_t & split_k, Node * & split_node) {
-        // there is one exclusive writer 
+    bool store(PMAllocator * alc, _key_t k, uint64_t v, _key_t & split_k, Node * & split_node, int8_t card = CARDINALITY) {
+        // there is one exclusive writer, the node splits once it holds card records
+        pmemu_read(this, sizeof(Node));
         state_.lock();
 
         Record &sibling = siblings_[state_.unpack.sibling_version]; // the sibling is updated atomically, we are safe here
         if(k >= sibling.key) { // if the node has splitted and k to find is in next node 
-            Node * sib_node = (Node *)galc->absolute(sibling.val);
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
             state_.unlock();
-            return sib_node->store(k, v, split_k, split_node);
+            // card was chosen for this node, its sibling may be another sub-index root
+            return sib_node->store(alc, k, v, split_k, split_node);
         }
 
-        if(state_.unpack.count == CARDINALITY) { // should split the node
+        if(state_.unpack.count >= card) { // should split the node
+            meter_split();
             uint64_t m = state_.unpack.count / 2;
             split_k = recs_[state_.read(m)].key;
 
             // copy half of the records into split node
             int8_t j = 0;
             state_t new_state = state_;
+            alignas(CACHE_LINE_SIZE) char img_buf[sizeof(Node)];
+            Node * img;
+            if(use_ntstore) { // build the split node in DRAM, then stream it into PM
+                split_node = (Node *)alc->malloc(sizeof(Node));
+                img = ::new (img_buf) Node;
+            } else {
+                split_node = img = ::new (alc->malloc(sizeof(Node))) Node;
+            }
+            img->state_.lock();
             if(leftmost_ptr_ == NULL) {
-                split_node = new Node;
-                split_node->state_.lock();
                 for(int i = m; i < state_.unpack.count; i++) {
                     int8_t slotid = state_.read(i);
-                    split_node->append(recs_[slotid], j, j);
+                    img->append(recs_[slotid], j, j);
                     j += 1;
                 }
 
                 new_state.unpack.count -= j;
             } else {
                 int8_t slotid = state_.read(m);
-                split_node = new Node();
-                split_node->state_.lock();
-                split_node->leftmost_ptr_ = recs_[slotid].val;
+                img->leftmost_ptr_ = recs_[slotid].val;
 
                 for(int i = m + 1; i < state_.unpack.count; i++) {
                     slotid = state_.read(i);
-                    split_node->append(recs_[slotid], j, j);
+                    img->append(recs_[slotid], j, j);
                     j += 1;
                 }
 
                 new_state.unpack.count -= (j + 1);
             }
-            split_node->state_.unpack.count = j;
-            split_node->state_.unpack.sibling_version = 0;
+            img->state_.unpack.count = j;
+            img->state_.unpack.sibling_version = 0;
             // the sibling node of current node pointed by split_node
-            split_node->siblings_[0] = siblings_[state_.unpack.sibling_version];
-            clwb(split_node, 64); // persist header
-            clwb(&split_node->recs_[1], sizeof(Record) * (j - 1)); // persist all the inserted records
+            img->siblings_[0] = siblings_[state_.unpack.sibling_version];
+            PersistBatch & pb = PersistBatch::local();
+
+            /* the new record shares the fence of the split when no published state refers to its
+                slot: the split node is reached through the new state of this node only, and a slot
+                of this node free before the split is not read by the old state. A full node
+                inserting on the left has no such slot, its record is fenced after the new state */
+            bool staged = true;
+            if(k >= split_k)
+                img->stage(img->state_, k, (char *)v);
+            else if(state_.unpack.count < CARDINALITY)
+                pb.add(&recs_[stage(new_state, k, (char *)v)], sizeof(Record));
+            else
+                staged = false;
+
+            if(use_ntstore) {
+                ntstore(split_node, img, sizeof(Node));
+            } else {
+                pb.add(split_node, 64); // persist header
+                pb.add(&split_node->recs_[1], sizeof(Record) * (img->state_.unpack.count - 1)); // persist all the inserted records
+            }
             
             // the split node is installed as the shadow sibling of current node
-            siblings_[(state_.unpack.sibling_version + 1) % 2] = {split_k, (char *)galc->relative(split_node)};
+            // (it shares the first cache line with state_, so it is written back along with it)
+            siblings_[(state_.unpack.sibling_version + 1) % 2] = {split_k, (char *)alc->relative(split_node)};
             // persist_assign the state field
             new_state.unpack.sibling_version = (state_.unpack.sibling_version + 1) % 2;
-            mfence(); // a barrier here to make sure all the update is persisted to storage
+            pb.fence(); // a barrier here to make sure all the update is persisted to storage
 
-            persist_assign(&(state_.pack), new_state.pack);
-            
-            // go on the insertion
-            if(k < split_k) {
-                insertone(k, (char *)v);
-            } else {
-                split_node->insertone(k, (char *)v);                
-            }
+            pb.assign(&(state_.pack), new_state.pack);
+            if(staged)
+                pb.flush();
+            else
+                insertone(k, (char *)v); // its fence writes back the new state as well
             split_node->state_.unlock();
             state_.unlock();
             return true;
@@ -226,21 +257,23 @@ public:
         }
     }
 
-    char * get_child(_key_t k) { 
+    char * get_child(PMAllocator * alc, _key_t k) { 
         // use optimized lock to coordinate reader with writer
+        pmemu_read(this, sizeof(Node));
         get_retry:
         uint64_t old_version = state_.unpack.node_version;
         barrier();
 
         Record &sibling = siblings_[state_.unpack.sibling_version]; // the sibling is updated atomically, we are safe here
         if(k >= sibling.key) { // if the node has splitted and k to find is in next node 
-            Node * sib_node = (Node *)galc->absolute(sibling.val);
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
             
             barrier();
             if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
+                stat_add(stats::OLC_RETRY_CHILD);
                 goto get_retry;
             }
-            return sib_node->get_child(k);
+            return sib_node->get_child(alc, k);
         }
 
         if(leftmost_ptr_ == NULL) {
@@ -260,41 +293,136 @@ public:
             
             barrier();
             if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
+                stat_add(stats::OLC_RETRY_CHILD);
                 goto get_retry;
             }
             return ret;
         } else {
-            int8_t slotid = 0, pos = state_.unpack.count;
-            for(int i = 0; i < state_.unpack.count; i++) {
-                slotid = state_.read(i);
-                if(recs_[slotid].key > k) {
-                    pos = i;
-                    break;
-                }
+            char * ret = child_at(child_pos(k));
+            
+            barrier();
+            if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
+                stat_add(stats::OLC_RETRY_CHILD);
+                goto get_retry;
             }
+            return ret;
+        }
+    }
 
-            char * ret;
-            if (pos == 0) // all the key is bigger than k
-                ret = leftmost_ptr_;
-            else 
-                ret = recs_[state_.read(pos - 1)].val;
+    char * get_child(PMAllocator * alc, _key_t k, _key_t & upper) { 
+        // get the child of an inner node, and the upper bound of keys in that child
+        pmemu_read(this, sizeof(Node));
+        get_retry:
+        uint64_t old_version = state_.unpack.node_version;
+        barrier();
+
+        Record &sibling = siblings_[state_.unpack.sibling_version];
+        if(k >= sibling.key) { // if the node has splitted and k to find is in next node 
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
             
             barrier();
             if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
+                stat_add(stats::OLC_RETRY_CHILD);
                 goto get_retry;
             }
-            return ret;
+            return sib_node->get_child(alc, k, upper);
+        }
+
+        int8_t pos = child_pos(k);
+        char * ret = child_at(pos);
+        _key_t bound = (pos == state_.unpack.count ? sibling.key : recs_[state_.read(pos)].key);
+
+        barrier();
+        if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
+            stat_add(stats::OLC_RETRY_CHILD);
+            goto get_retry;
+        }
+        upper = std::min(upper, bound);
+        return ret;
+    }
+
+    int scan(PMAllocator * alc, _key_t start, int len, Record * out, Node * &next, bool &forward) {
+        /* copy at most len records no less than start of this leaf in key order, and get the next
+            leaf; forward tells if this leaf is merged or unlinked, and next is its left neighbour */
+        pmemu_read(this, sizeof(Node));
+        scan_retry:
+        uint64_t old_version = state_.unpack.node_version;
+        barrier();
+
+        state_t st(state_.pack); // a snapshot of the slot array
+        Record &sibling = siblings_[st.unpack.sibling_version];
+        char * next_ptr = sibling.val;
+        forward = sibling.key == MIN_KEY;
+
+        int cnt = 0;
+        for(int i = 0; i < st.unpack.count && cnt < len; i++) {
+            Record &r = recs_[st.read(i)];
+            if(r.key >= start)
+                out[cnt++] = r;
+        }
+
+        barrier();
+        if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
+            stat_add(stats::OLC_RETRY_CHILD);
+            goto scan_retry;
+        }
+        next = (Node *)alc->absolute(next_ptr); // NULL at the last leaf
+        return cnt;
+    }
+
+    int store_run(PMAllocator * alc, const Record * recs, int n, _key_t upper) {
+        // store a sorted run of records into this leaf under one latch, return the number stored
+        pmemu_read(this, sizeof(Node));
+        state_.lock();
+
+        Record &sibling = siblings_[state_.unpack.sibling_version];
+        if(recs[0].key >= sibling.key) { // if the node has splitted and k to find is in next node 
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
+            state_.unlock();
+            return sib_node->store_run(alc, recs, n, upper);
+        }
+        upper = std::min(upper, sibling.key);
+
+        int cnt = 0;
+        int8_t slots[CARDINALITY];
+        state_t new_state = state_;
+        while(cnt < n && new_state.unpack.count < CARDINALITY && recs[cnt].key < upper) {
+            int8_t idx;
+            for(idx = 0; idx < new_state.unpack.count; idx++) {
+                if(recs[cnt].key < recs_[new_state.read(idx)].key) {
+                    break;
+                }
+            }
+
+            int8_t slotid = new_state.alloc();
+            recs_[slotid] = recs[cnt];
+            new_state.pack = new_state.add(idx, slotid);
+            slots[cnt++] = slotid;
+        }
+
+        if(cnt > 0) { // one fence for all the records, then atomically update the state
+            PersistBatch & pb = PersistBatch::local();
+            for(int i = 0; i < cnt; i++)
+                pb.add(&recs_[slots[i]], sizeof(Record));
+            pb.fence();
+
+            pb.assign(&(state_.pack), new_state.pack);
+            pb.flush();
         }
+
+        state_.unlock();
+        return cnt;
     }
 
-    bool update(_key_t k, uint64_t v) {
+    bool update(PMAllocator * alc, _key_t k, uint64_t v) {
+        pmemu_read(this, sizeof(Node));
         state_.lock(false);
 
         Record &sibling = siblings_[state_.unpack.sibling_version]; // the sibling is updated atomically, we are safe here
         if(k >= sibling.key) { // if the node has splitted and k to find is in next node 
-            Node * sib_node = (Node *)galc->absolute(sibling.val);
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
             state_.unlock(false);
-            return sib_node->update(k, v);
+            return sib_node->update(alc, k, v);
         }
 
         uint64_t slotid = 0;
@@ -307,8 +435,9 @@ public:
 
         bool found = false;
         if (recs_[slotid].key == k) {
-            recs_[slotid].val = (char *)v;
-            clwb(&recs_[slotid], sizeof(Record));
+            PersistBatch & pb = PersistBatch::local();
+            pb.assign(&recs_[slotid].val, (char *)v);
+            pb.flush();
             found = true;
         }
 
@@ -316,14 +445,15 @@ public:
         return found;
     }
 
-    bool remove(_key_t k) {
+    bool remove(PMAllocator * alc, _key_t k) {
         // Non-SMO delete takes only one clwb 
+        pmemu_read(this, sizeof(Node));
         state_.lock();
         Record &sibling = siblings_[state_.unpack.sibling_version];
         if(k >= sibling.key) { // if the node has splitted and k to find is in next node 
-            Node * sib_node = (Node *)galc->absolute(sibling.val);
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
             state_.unlock();
-            return sib_node->remove(k);
+            return sib_node->remove(alc, k);
         }
 
         if(leftmost_ptr_ == NULL) {
@@ -335,8 +465,9 @@ public:
             }
 
             if(recs_[slotid].key == k) {
-                uint64_t newpack = state_.remove(idx);
-                persist_assign(&(state_.pack), newpack);
+                PersistBatch & pb = PersistBatch::local();
+                pb.assign(&(state_.pack), state_.remove(idx));
+                pb.flush();
                 state_.unlock();
                 return true;
             } else {
@@ -354,15 +485,16 @@ public:
                 * We will never remove the leftmost child in our wbtree design
                 * So the idx here must be larger than 0
                 */
-            uint64_t newpack = state_.remove(idx - 1);
-            persist_assign(&(state_.pack), newpack);
+            PersistBatch & pb = PersistBatch::local();
+            pb.assign(&(state_.pack), state_.remove(idx - 1));
+            pb.flush();
             
             state_.unlock();
             return true;
         }
     }
 
-    void print(string prefix, bool recursively) const {
+    void print(PMAllocator * alc, string prefix, bool recursively) const {
         printf("%s[%lx(%ld) ", prefix.c_str(), state_.unpack.slotArray, state_.unpack.count);
 
         for(int i = 0; i < state_.unpack.count; i++) {
@@ -376,12 +508,12 @@ public:
         printf("]\n");
 
         if(recursively && leftmost_ptr_ != NULL) {
-            Node * child = (Node *)galc->absolute(leftmost_ptr_);
-            child->print(prefix + "    ", recursively);
+            Node * child = (Node *)alc->absolute(leftmost_ptr_);
+            child->print(alc, prefix + "    ", recursively);
 
             for(int i = 0; i < state_.unpack.count; i++) {
-                Node * child = (Node *)galc->absolute(recs_[state_.read(i)].val);
-                child->print(prefix + "    ", recursively);
+                Node * child = (Node *)alc->absolute(recs_[state_.read(i)].val);
+                child->print(alc, prefix + "    ", recursively);
             }
         }
     }
@@ -394,23 +526,31 @@ public:
 
 public:
     void insertone(_key_t key, char * right) {
+        // insert and flush the kv, then atomically update the state
+        PersistBatch & pb = PersistBatch::local();
+        state_t new_state = state_;
+        pb.add(&recs_[stage(new_state, key, right)], sizeof(Record));
+        pb.fence();
+
+        pb.assign(&(state_.pack), new_state.pack);
+        pb.flush();
+    }
+
+    int8_t stage(state_t & st, _key_t key, char * right) {
+        // write the record into a slot free in state_, and add it to st, whose slots are those of
+        // state_ or fewer; nothing is written back, return the slot
         int8_t idx;
-        for(idx = 0; idx < state_.unpack.count; idx++) {
-            int8_t slotid = state_.read(idx);
+        for(idx = 0; idx < st.unpack.count; idx++) {
+            int8_t slotid = st.read(idx);
             if(key < recs_[slotid].key) {
                 break;
             }
         }
-        
-        // insert and flush the kv
+
         int8_t slotid = state_.alloc(); // alloc a slot in the node
         recs_[slotid] = {key, (char *) right};
-        clwb(&recs_[slotid], sizeof(Record));
-        mfence();
-
-        // atomically update the state
-        uint64_t new_pack = state_.add(idx, slotid);
-        persist_assign(&(state_.pack), new_pack);
+        st.pack = st.add(idx, slotid);
+        return slotid;
     }
 
     void append(Record r, int8_t slotid, int8_t pos) {
@@ -418,11 +558,69 @@ public:
         state_.pack = state_.append(pos, slotid);
     }
 
-    static void merge(Node * left, Node * right) {
+    int8_t child_pos(_key_t k) const { // the position of the child of an inner node holding k
+        for(int i = 0; i < state_.unpack.count; i++) {
+            if(recs_[state_.read(i)].key > k)
+                return i;
+        }
+        return state_.unpack.count;
+    }
+
+    char * child_at(int8_t pos) const { // the pos-th child of an inner node, pos 0 is leftmost_ptr_
+        return pos == 0 ? leftmost_ptr_ : recs_[state_.read(pos - 1)].val;
+    }
+
+    bool merge_child(PMAllocator * alc, _key_t k, Node * & dead) {
+        /* merge the child holding k with its left (or right) neighbour under this node, the
+            right one of the pair is emptied and forwards to the left one. Latches are taken
+            top down and left to right, this node, left, right, so merges never deadlock with
+            each other, and splits never hold a child latch while waiting for this one.
+            return whether this node underflows; dead is the emptied child, to be retired */
+        dead = NULL;
+        pmemu_read(this, sizeof(Node));
+        state_.lock();
+
+        Record &sibling = siblings_[state_.unpack.sibling_version];
+        if(k >= sibling.key) { // if the node has splitted and k to find is in next node 
+            Node * sib_node = (Node *)alc->absolute(sibling.val);
+            state_.unlock();
+            return sib_node->merge_child(alc, k, dead);
+        }
+
+        int8_t pos = child_pos(k);
+
+        // try the left neighbour first, as the sequential version did
+        for(int8_t lpos : {(int8_t)(pos - 1), pos}) {
+            if(lpos < 0 || lpos + 1 > state_.unpack.count) continue;
+            Node * left = (Node *)alc->absolute(child_at(lpos));
+            Node * right = (Node *)alc->absolute(child_at(lpos + 1));
+            if(merge(alc, left, right)) {
+                PersistBatch & pb = PersistBatch::local();
+                pb.assign(&(state_.pack), state_.remove(lpos)); // drop the separator of right
+                pb.flush();
+                dead = right;
+                break;
+            }
+        }
+
+        bool underflow = state_.unpack.count < UNDERFLOW_CARD;
+        state_.unlock();
+        return underflow;
+    }
+
+    static bool merge(PMAllocator * alc, Node * left, Node * right) {
+        // the caller holds the latch of their parent, return false if they do not fit in one node
         left->state_.lock();
         right->state_.lock();
 
         Record & sibling = left->siblings_[left->state_.unpack.sibling_version];
+        if((Node *)alc->absolute(sibling.val) != right // left has split, its new sibling is not in the parent yet
+            || left->state_.unpack.count + right->state_.unpack.count >= CARDINALITY) {
+            right->state_.unlock();
+            left->state_.unlock();
+            return false;
+        }
+        stat_add(stats::NODE_MERGE);
 
         state_t new_state = left->state_;
         if(left->leftmost_ptr_ != NULL) { // insert the leftmost_ptr of the right node
@@ -439,63 +637,43 @@ public:
         Record tmp = right->siblings_[right->state_.unpack.sibling_version];
         left->siblings_[(left->state_.unpack.sibling_version + 1) % 2] = tmp;
         new_state.unpack.sibling_version = (left->state_.unpack.sibling_version + 1) % 2;
-        clwb(left, sizeof(Node)); // persist the whole leaf node
+        PersistBatch & pb = PersistBatch::local();
+        pb.add(left, sizeof(Node)); // persist the whole leaf node
 
         // persist_assign the state_ field
-        mfence();
-        left->state_.pack = new_state.pack;
-        clwb(left, 64);
-
+        pb.fence();
+        pb.assign(&(left->state_.pack), new_state.pack);
+        pb.fence();
+
+        /* right forwards every key to left: readers and writers that reached it through a
+            stale parent or sibling move on to left, which holds its records now. It is persisted
+            after left, so after a crash right either holds its records or forwards to them */
+        state_t dead_state = right->state_;
+        right->siblings_[(dead_state.unpack.sibling_version + 1) % 2] = {MIN_KEY, (char *)alc->relative(left)};
+        dead_state.unpack.sibling_version = (dead_state.unpack.sibling_version + 1) % 2;
+        dead_state.unpack.count = 0;
+        pb.assign(&(right->state_.pack), dead_state.pack);
+        pb.flush();
+
+        right->state_.unlock();
         left->state_.unlock();
-
-        galc->free(right); // WARNING: persistent memory leak here
-    }
-
-    void get_lrchild(_key_t k, Node * & left, Node * & right) {
-        get_retry:
-        uint64_t old_version = state_.unpack.node_version;
-        barrier();
-        if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
-            goto get_retry;
-        }
-
-        int16_t i = 0;
-        for( ; i < state_.unpack.count; i++) {
-            int8_t slotid = state_.read(i);
-            if(recs_[slotid].key > k)
-                break;
-        }
-
-        if(i == 0) {
-            left = NULL;
-        } else if(i == 1) {
-            left = (Node *)galc->absolute(leftmost_ptr_);
-        } else {
-            left = (Node *)galc->absolute(recs_[state_.read(i - 2)].val);
-        }
-
-        if(i == state_.unpack.count) {
-            right = NULL;
-        } else {
-            right = (Node *)galc->absolute(recs_[state_.read(i)].val);
-        }
-
-        barrier();
-        if(old_version != state_.unpack.node_version || old_version % 2 != 0) {
-            goto get_retry;
-        }
-        return ;
+        return true;
     }
 };
 
-extern bool insert_recursive(Node * n, _key_t k, uint64_t v, _key_t &split_k, 
-                                Node * &split_node, int8_t &level);
-extern bool remove_recursive(Node * n, _key_t k);
-extern bool find(Node ** rootPtr, _key_t key, uint64_t &val);
-extern res_t insert(Node ** rootPtr, _key_t key, uint64_t val, int threshold);
-extern bool update(Node ** rootPtr, _key_t key, uint64_t val);
-extern bool remove(Node ** rootPtr, _key_t key);
-extern void printAll(Node ** rootPtr);
+extern bool insert_recursive(PMAllocator * alc, Node * n, _key_t k, uint64_t v, _key_t &split_k, 
+                                Node * &split_node, int8_t &level, int8_t card = CARDINALITY);
+extern bool remove_recursive(PMAllocator * alc, Node * n, _key_t k);
+extern bool find(PMAllocator * alc, Node ** rootPtr, _key_t key, uint64_t &val);
+extern res_t insert(PMAllocator * alc, Node ** rootPtr, _key_t key, uint64_t val, int threshold, int8_t root_card = CARDINALITY);
+extern int insert_run(PMAllocator * alc, Node ** rootPtr, const Record * recs, int n, int threshold, res_t & split);
+extern bool update(PMAllocator * alc, Node ** rootPtr, _key_t key, uint64_t val);
+extern int scan(PMAllocator * alc, Node ** rootPtr, _key_t start, int len, Record * out);
+extern bool remove(PMAllocator * alc, Node ** rootPtr, _key_t key);
+extern bool empty(PMAllocator * alc, Node ** rootPtr);
+extern int unlink(PMAllocator * alc, Node * prev, Node * root, Node ** path);
+extern void printAll(PMAllocator * alc, Node ** rootPtr);
+extern int footprint(PMAllocator * alc, Node ** rootPtr, level_usage_t * levels);
 
 } // namespace wotree256
 
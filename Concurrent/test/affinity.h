@@ -0,0 +1,138 @@
+/*  affinity.h - pin benchmark threads to cores and estimate NUMA remote accesses
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <glob.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+    Pinning policies, each gives the order in which threads take CPUs:
+        none     leave the threads to the scheduler
+        compact  fill a socket before the next, SMT siblings of a core next to each other
+        scatter  alternate sockets, one thread per physical core before any SMT sibling
+        socket   only the CPUs of the first socket, physical cores first
+*/
+enum PinPolicy {PIN_NONE = 0, PIN_COMPACT, PIN_SCATTER, PIN_SOCKET};
+
+static const char * PIN_NAMES[] = {"none", "compact", "scatter", "socket"};
+
+struct cpu_info_t {
+    int cpu;
+    int socket;
+    int core;
+    int smt;    // the rank of this CPU among the SMT siblings of its core
+    int rank;   // the rank of its core in the socket
+    int node;   // the NUMA node of this CPU
+};
+
+inline int read_int(const char * path, int dflt) {
+    FILE * fp = fopen(path, "r");
+    if(fp == NULL) return dflt;
+    int v = dflt;
+    if(fscanf(fp, "%d", &v) != 1) v = dflt;
+    fclose(fp);
+    return v;
+}
+
+inline int cpu_node(int cpu) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "/sys/devices/system/cpu/cpu%d/node*", cpu);
+    glob_t g;
+    int node = 0;
+    if(glob(pattern, 0, NULL, &g) == 0 && g.gl_pathc > 0)
+        node = atoi(strrchr(g.gl_pathv[0], 'e') + 1); // ".../nodeN"
+    globfree(&g);
+    return node;
+}
+
+inline std::vector<cpu_info_t> cpu_topology() {
+    std::vector<cpu_info_t> cpus;
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    char path[128];
+    for(int c = 0; c < CPU_SETSIZE; c++) {
+        if(!CPU_ISSET(c, &allowed)) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+        int socket = read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+        int core = read_int(path, c);
+        cpus.push_back({c, socket, core, 0, 0, cpu_node(c)});
+    }
+
+    // rank the SMT siblings of each core, and the cores of each socket
+    for(auto & a : cpus) {
+        std::vector<int> cores;
+        for(auto & b : cpus) {
+            if(b.socket != a.socket) continue;
+            if(b.core == a.core && b.cpu < a.cpu) a.smt++;
+            cores.push_back(b.core);
+        }
+        std::sort(cores.begin(), cores.end());
+        cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+        a.rank = std::lower_bound(cores.begin(), cores.end(), a.core) - cores.begin();
+    }
+    return cpus;
+}
+
+// the CPUs taken by thread 0, 1, ... under a policy, empty for PIN_NONE
+inline std::vector<cpu_info_t> pin_order(PinPolicy policy) {
+    std::vector<cpu_info_t> cpus;
+    if(policy == PIN_NONE) return cpus;
+
+    cpus = cpu_topology();
+    auto key = [policy](const cpu_info_t & c) {
+        if(policy == PIN_COMPACT)
+            return std::make_tuple(c.socket, c.rank, c.smt);
+        else // scatter and socket
+            return std::make_tuple(c.smt, c.rank, c.socket);
+    };
+    std::sort(cpus.begin(), cpus.end(), [&](const cpu_info_t & a, const cpu_info_t & b) {
+        return key(a) < key(b);
+    });
+    if(policy == PIN_SOCKET) {
+        int first = cpus.front().socket;
+        for(auto & c : cpus) first = std::min(first, c.socket);
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [first](const cpu_info_t & c) {
+            return c.socket != first;
+        }), cpus.end());
+    }
+    return cpus;
+}
+
+inline bool pin_thread(int cpu) { // pin the calling thread
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+/*
+ *  The NUMA nodes holding pages of [addrs], -1 for pages not faulted in yet
+ *  Queried with move_pages(2) without moving anything, so libnuma is not needed
+ */
+inline std::vector<int> page_nodes(std::vector<void *> & addrs) {
+    std::vector<int> status(addrs.size(), -1);
+    if(addrs.empty()) return status;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    for(auto & a : addrs)
+        a = (void *)((uint64_t)a & ~(uint64_t)(pagesize - 1));
+    if(syscall(SYS_move_pages, 0, addrs.size(), addrs.data(), NULL, status.data(), 0) != 0)
+        std::fill(status.begin(), status.end(), -1);
+    return status;
+}
+
+#endif // __AFFINITY_H__
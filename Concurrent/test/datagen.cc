@@ -5,9 +5,13 @@
 #include <cstdlib>
 #include <unistd.h>
 #include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cctype>
 
 #include "common.h"
 #include "zipfian.h"
+#include "workload.h"
 
 using std::cout;
 using std::endl;
@@ -15,7 +19,9 @@ using std::string;
 using std::ofstream;
 using std::ifstream;
 
-enum DistributionType {RAND = 0, ZIPFIAN};
+enum DistributionType {RAND = 0, ZIPFIAN, LATEST, HOTSPOT};
+
+static const char * DIST_NAMES[] = {"random", "Zipfian", "latest", "hotspot"};
 
 struct WorkloadType {
     int operations = MILLION;
@@ -23,10 +29,30 @@ struct WorkloadType {
     float insert = 0;
     float update = 0;
     float remove = 0;
+    float scan = 0;
+    float rmw = 0;
     DistributionType dist = RAND;
     float skewness = 0.8;
+    int scan_max = 100;     // scan lengths are uniform in [1, scan_max]
+    float hot_set = 0.2;    // for hotspot distribution, the fraction of keys that are hot
+    float hot_ops = 0.8;    // and the fraction of operations that go to them
     bool valid() {
-        return read + insert + update + remove == 1.0 && skewness > 0 && skewness < 1.0;
+        return std::abs(read + insert + update + remove + scan + rmw - 1.0) < 1e-6 && 
+                skewness > 0 && skewness < 1.0 && scan_max > 0;
+    }
+    bool preset(char name) { // the core workloads of YCSB
+        read = insert = update = remove = scan = rmw = 0;
+        skewness = 0.99;
+        switch(name) {
+        case 'A': read = 0.5;  update = 0.5;  dist = ZIPFIAN; break; // update heavy
+        case 'B': read = 0.95; update = 0.05; dist = ZIPFIAN; break; // read mostly
+        case 'C': read = 1.0;                 dist = ZIPFIAN; break; // read only
+        case 'D': read = 0.95; insert = 0.05; dist = LATEST;  break; // read latest
+        case 'E': scan = 0.95; insert = 0.05; dist = ZIPFIAN; break; // short ranges
+        case 'F': read = 0.5;  rmw = 0.5;     dist = ZIPFIAN; break; // read-modify-write
+        default: return false;
+        }
+        return true;
     }
     void print() {
         cout << "=========WORKLOAD TYPE=========" << endl;
@@ -35,10 +61,18 @@ struct WorkloadType {
         cout << "Insert Ratio: " << insert << endl;
         cout << "Update Ratio: " << update << endl;
         cout << "Remove Ratio: " << remove << endl;
-        cout << "Distribution: " << (dist == RAND ? "random" : "Zipfian") << endl;
-        if (dist == ZIPFIAN) {
+        cout << "Scan Ratio  : " << scan << endl;
+        cout << "RMW Ratio   : " << rmw << endl;
+        cout << "Distribution: " << DIST_NAMES[dist] << endl;
+        if (dist == ZIPFIAN || dist == LATEST) {
             cout << "Skewness " << skewness << endl;
         }
+        if (dist == HOTSPOT) {
+            cout << "Hotspot " << hot_ops << " of operations on " << hot_set << " of keys" << endl;
+        }
+        if (scan > 0) {
+            cout << "Scan Length : 1 - " << scan_max << endl;
+        }
         cout << "===============================" << endl;
     }
 };
@@ -50,22 +84,20 @@ public :
     std::uniform_int_distribution<uint32_t> dist_;
 
     OperationGenerator(WorkloadType &w) : gen_(getRandom()) {
-        int read_end = 100 * w.read;
-        int insert_end = read_end + 100 * w.insert;
-        int update_end = insert_end + 100 * w.update;
-        int remove_end = update_end + 100 * w.remove;
-
-        for(int i = 0; i < read_end; i++)
-            mappings_[i] = OperationType::READ;
-
-        for(int i = read_end; i < insert_end; i++)
-            mappings_[i] = OperationType::INSERT;
+        float ratios[] = {w.read, w.insert, w.update, w.remove, w.scan, w.rmw};
+        OperationType ops[] = {OperationType::READ, OperationType::INSERT, OperationType::UPDATE, 
+                                OperationType::DELETE, OperationType::SCAN, OperationType::RMW};
 
-        for(int i = insert_end; i < update_end; i++)
-            mappings_[i] = OperationType::UPDATE;
-
-        for(int i = update_end; i < remove_end; i++)
-            mappings_[i] = OperationType::DELETE;
+        int end = 0, acc = 0;
+        for(int k = 0; k < 6; k++) {
+            int begin = end;
+            acc += std::lround(100 * ratios[k]); // round, so that 0.95 makes 95 slots
+            end = std::min(acc, 100);
+            for(int i = begin; i < end; i++)
+                mappings_[i] = ops[k];
+        }
+        for(int i = end; i < 100; i++) // rounding may leave a slot or two
+            mappings_[i] = mappings_[end - 1];
     }
 
     OperationType next() {
@@ -107,24 +139,49 @@ void gen_workload(int64_t *arr, uint64_t scale, QueryType * querys, WorkloadType
     std::mt19937 gen(getRandom());
     std::uniform_int_distribution<int64_t> idx1_dist(0, scale - 1);
     zipfian_int_distribution<int64_t> idx2_dist(0, scale - 1, w.skewness);
+    uint64_t hot_cnt = std::max((uint64_t)1, (uint64_t)(scale * w.hot_set));
+    std::uniform_int_distribution<int64_t> hot_dist(0, hot_cnt - 1);
+    std::uniform_int_distribution<int64_t> cold_dist(std::min(hot_cnt, scale - 1), scale - 1);
+    std::uniform_real_distribution<float> hot_coin(0, 1);
+    std::uniform_int_distribution<int32_t> len_dist(1, w.scan_max);
     OperationGenerator op_gen(w);
 
+    // for latest distribution: keys ordered by insertion, the dataset is loaded in array order
+    std::vector<_key_t> inserted;
+    auto recent = [&](uint64_t r) { // the r-th most recently inserted key
+        uint64_t i = scale + inserted.size() - 1 - r;
+        return i < scale ? arr[i] : inserted[i - scale];
+    };
+
     for(int i = 0; i < w.operations; i++) {
         OperationType op = op_gen.next();
-        int idx = (w.dist == RAND ? idx1_dist(gen) : idx2_dist(gen));
+        _key_t key;
+        switch(w.dist) {
+        case ZIPFIAN: key = arr[idx2_dist(gen)]; break;
+        case LATEST:  key = recent(idx2_dist(gen)); break;
+        case HOTSPOT: key = arr[hot_coin(gen) < w.hot_ops ? hot_dist(gen) : cold_dist(gen)]; break;
+        default:      key = arr[idx1_dist(gen)]; break;
+        }
+
         // for insert operations, we should make sure the key does not exist in the dataset
-        _key_t key = (op == OperationType::INSERT ? arr[idx] + getRandom(): arr[idx]); 
+        if(op == OperationType::INSERT) {
+            key = key + getRandom();
+            if(w.dist == LATEST) inserted.push_back(key);
+        }
 
-        querys[i] = {op, key};
+        querys[i] = {op, op == OperationType::SCAN ? len_dist(gen) : 0, key};
     }
 }
 
 int main(int argc, char ** argv) {
     static const bool DATASET_RANDOM = true;
-    bool opt_zipfian  = false;
+    DistributionType opt_dist = RAND;
+    char opt_preset = 0;
+    float opt_skewness = 0;
+    bool opt_text = false;
     WorkloadType w;
 
-    static const char * optstr = "r:i:u:d:o:s:hz"; 
+    static const char * optstr = "r:i:u:d:o:s:w:m:hzlpT"; 
     opterr = 0;
     char opt;
     while((opt = getopt(argc, argv, optstr)) != -1) {
@@ -133,7 +190,7 @@ int main(int argc, char ** argv) {
             w.operations = atoi(optarg) * MILLION;
             break;
         case 's':
-            w.skewness = atof(optarg);
+            opt_skewness = atof(optarg);
             break;
         case 'r':
             w.read = atof(optarg);
@@ -148,31 +205,58 @@ int main(int argc, char ** argv) {
             w.update = atof(optarg);
             break;
         case 'z':
-            opt_zipfian = true;
+            opt_dist = ZIPFIAN;
+            break;
+        case 'l':
+            opt_dist = LATEST;
+            break;
+        case 'p':
+            opt_dist = HOTSPOT;
+            break;
+        case 'w':
+            opt_preset = toupper(optarg[0]);
+            break;
+        case 'm':
+            w.scan_max = atoi(optarg);
+            break;
+        case 'T':
+            opt_text = true;
             break;
         case '?':
         case 'h':
         default:
             cout << "USAGE: "<< argv[0] << "[option]" << endl;
             cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -w: " << "YCSB core workload A - F, overrides the ratios and the distribution" << endl;
             cout << "\t -z: " << "Use zipfian distribution (Not specified: random distribution)" << endl;
+            cout << "\t -l: " << "Use latest distribution, recently inserted keys are more popular" << endl;
+            cout << "\t -p: " << "Use hotspot distribution, 80% of operations on 20% of keys" << endl;
             cout << "\t -o: " << "The number of operations" << endl;
             cout << "\t -s: " << "The skewness of query workload(0 - 1)" << endl;
             cout << "\t -r: " << "Read ratio" << endl;
             cout << "\t -i: " << "Insert ratio" << endl;
             cout << "\t -u: " << "update ratio" << endl;
             cout << "\t -d: " << "Delete ratio" << endl;
+            cout << "\t -m: " << "Max scan length (default 100)" << endl;
+            cout << "\t -T: " << "Also write the workload as text into workload.txt" << endl;
             exit(-1);
         }
     }
 
+    if(opt_dist != RAND) {
+        w.dist = opt_dist;
+    }
+    if(opt_preset != 0 && !w.preset(opt_preset)) {
+        cout << "Unknown YCSB workload " << opt_preset << endl;
+        exit(-1);
+    }
+    if(opt_skewness != 0) {
+        w.skewness = opt_skewness;
+    }
     if(!w.valid()) {
         cout << "Invalid workload configuration" << endl;
         exit(-1);
     }
-    if(opt_zipfian == true) {
-        w.dist = ZIPFIAN;
-    }
 
     w.print();
 
@@ -198,11 +282,20 @@ int main(int argc, char ** argv) {
     QueryType * querys = new QueryType[w.operations];
     gen_workload(arr, scale, querys, w);
     
-    ofstream fout("workload.txt");
-    for(int i = 0; i < w.operations; i++) {
-        fout << querys[i].op << " " << querys[i].key << endl;
+    if(!write_workload("workload.dat", querys, w.operations)) {
+        cout << "workload file not written" << endl;
+        exit(-1);
+    }
+    if(opt_text) { // a human readable copy
+        ofstream fout("workload.txt");
+        for(int i = 0; i < w.operations; i++) {
+            fout << querys[i].op << " " << querys[i].key;
+            if(querys[i].op == OperationType::SCAN)
+                fout << " " << querys[i].len;
+            fout << endl;
+        }
+        fout.close();
     }
-    fout.close();
     cout << "generate a query workload file" << endl;
 
     delete [] arr;
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+
+#include "tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+
+void print_footprint(const tlbtree_footprint_t & fp) {
+    const double MB = 1024.0 * 1024;
+    cout << "=========FOOTPRINT=========" << endl;
+    printf("%-12s %12s %12s %10s\n", "", "nodes", "MB", "fill");
+    printf("%-12s %12u %12.2f %10s\n", "top inner", fp.uptree_inner_cnt, fp.uptree_inner_bytes / MB, "-");
+    printf("%-12s %12u %12.2f %9.1f%%\n", "top leaf", fp.uptree_leaf_cnt, fp.uptree_leaf_bytes / MB, fp.uptree_leaf_fill * 100);
+    uint64_t nodes = 0, records = 0;
+    for(int l = fp.down_height - 1; l >= 0; l--) {
+        const auto & lv = fp.down_levels[l];
+        string name = l == 0 ? "down leaf" : "down L" + std::to_string(l);
+        printf("%-12s %12lu %12.2f %9.1f%%\n", name.c_str(), lv.nodes, lv.nodes * sizeof(wotree256::Node) / MB,
+                    lv.nodes == 0 ? 0 : 100.0 * lv.records / (lv.nodes * wotree256::CARDINALITY));
+        nodes += lv.nodes;
+        records += lv.records;
+    }
+    printf("%-12s %12lu %12.2f %9.1f%%\n", "down total", nodes, nodes * sizeof(wotree256::Node) / MB,
+                nodes == 0 ? 0 : 100.0 * records / (nodes * wotree256::CARDINALITY));
+    cout << "sub-index roots:    " << fp.subroots << endl;
+    cout << "records:            " << fp.down_levels[0].records << endl;
+
+    cout << "---- blocks of " << fp.block_size << "B ----" << endl;
+    printf("used:               %lu (%.2f MB)\n", fp.used_blocks, fp.used_blocks * fp.block_size / MB);
+    printf("reachable:          %lu\n", fp.reachable_blocks);
+    printf("unreachable:        %lu (%.2f MB, %.1f%% of used)\n", fp.unreachable_blocks, fp.unreachable_blocks * fp.block_size / MB,
+                fp.used_blocks == 0 ? 0 : 100.0 * fp.unreachable_blocks / fp.used_blocks);
+    printf("capacity:           %lu (%.2f MB)\n", fp.max_blocks, fp.max_blocks * fp.block_size / MB);
+    printf("headroom:           %.2f MB (%.1f%%)\n", fp.headroom_bytes / MB, 100.0 * fp.headroom_bytes / (fp.max_blocks * fp.block_size));
+    double top = fp.uptree_inner_bytes + fp.uptree_leaf_bytes;
+    printf("top layer headroom: %.2f MB, for objects of 4KB or more, the top layer takes %.2f MB\n", fp.large_headroom_bytes / MB, top / MB);
+    if(fp.down_levels[0].records > 0) {
+        double records = fp.down_levels[0].records;
+        double per_record = (double)(fp.used_blocks - fp.free_blocks) * fp.block_size / records;
+        // a rebuild allocates the new top layer while the old one is still in use
+        double more_blocks = fp.headroom_bytes / per_record;
+        double more_top = std::max(0.0, fp.large_headroom_bytes / (top / records) - records);
+        printf("bytes per record:   %.1f, about %.1f M more records fit (%.1f M by blocks, %.1f M by the top layer)\n",
+                    per_record, std::min(more_blocks, more_top) / 1e6, more_blocks / 1e6, more_top / 1e6);
+    }
+}
+
+int main(int argc, char ** argv) {
+    string opt_pool = "/mnt/pmem/tlbtree.pool";
+
+    static const char * optstr = "f:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'f':
+            opt_pool = string(optarg);
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -f: " << "The pool file to inspect, it is not modified (default /mnt/pmem/tlbtree.pool)" << endl;
+            exit(-1);
+        }
+    }
+
+    if(!file_exist(opt_pool.c_str())) {
+        cout << "the pool file " << opt_pool << " does not exist" << endl;
+        exit(-1);
+    }
+
+    print_footprint(TLBtree::footprint({opt_pool})); // the pool is only read
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*  histogram.h - a log-linear latency histogram in the style of HdrHistogram
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/*
+    Every power of two is split into 32 linear sub-buckets, so a recorded value
+    is reported with less than 3.2% relative error, over the whole 64-bit range.
+    Recording is a few instructions and never allocates; histograms of different
+    threads are merged after the run.
+*/
+class LatencyHistogram {
+private:
+    static const int SUB_BITS = 5;
+    static const int SUB_CNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    uint64_t counts_[BUCKETS];
+    uint64_t total_;
+    uint64_t sum_;
+    uint64_t max_;
+
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(counts_, 0, sizeof(counts_));
+        total_ = sum_ = max_ = 0;
+    }
+
+    inline void record(uint64_t v) {
+        counts_[index(v)]++;
+        total_++;
+        sum_ += v;
+        max_ = std::max(max_, v);
+    }
+
+    void merge(const LatencyHistogram & other) {
+        for(int i = 0; i < BUCKETS; i++)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ == 0 ? 0 : (double)sum_ / total_; }
+
+    uint64_t percentile(double p) const { // p in [0, 100]
+        if(total_ == 0) return 0;
+        uint64_t rank = std::max((uint64_t)1, (uint64_t)(p / 100 * total_ + 0.5));
+        uint64_t seen = 0;
+        for(int i = 0; i < BUCKETS; i++) {
+            seen += counts_[i];
+            if(seen >= rank)
+                return std::min(max_, value_of(i));
+        }
+        return max_;
+    }
+
+private:
+    static inline int index(uint64_t v) {
+        if(v < SUB_CNT) return v;
+        int e = 63 - __builtin_clzll(v); // v in [2^e, 2^(e+1))
+        return ((e - SUB_BITS + 1) << SUB_BITS) + ((v >> (e - SUB_BITS)) & (SUB_CNT - 1));
+    }
+
+    static inline uint64_t value_of(int idx) { // the middle of a bucket
+        if(idx < SUB_CNT) return idx;
+        int shift = (idx >> SUB_BITS) - 1;
+        uint64_t m = (idx & (SUB_CNT - 1)) + SUB_CNT;
+        return (m << shift) + ((1ULL << shift) >> 1);
+    }
+};
+
+#endif // __HISTOGRAM_H__
@@ -0,0 +1,85 @@
+/*  index.h - the common interface of the indexes compared by the benchmark driver
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+
+/*
+    Index:
+        the operations replayed by main, on plain integer types only. This header must not
+        depend on either TLBtree variant: the Single variant is built into its own shared
+        library with hidden symbols (see test/CMakeLists.txt), and is only reachable through
+        this interface and create_single_index().
+*/
+class Index {
+public:
+    virtual ~Index() {}
+
+    virtual void insert(int64_t key, uint64_t val) = 0;
+    virtual uint64_t lookup(int64_t key) = 0;           // 0 if the key is not found
+    virtual bool update(int64_t key, uint64_t val) = 0;
+    virtual bool remove(int64_t key) = 0;
+    virtual int scan(int64_t start, int len) = 0;       // the number of records visited, -1 if not supported
+
+    virtual bool concurrent() const { return true; }    // whether threads may share it
+    virtual void sample_blocks(std::vector<void *> & /* addrs */, size_t /* cnt */) {} // addresses of allocated nodes
+    virtual void mark_stats() {}                        // print_stats counts from here on
+    virtual void print_stats() {}
+};
+
+// the Single variant of TLBtree, test/single_index.cc
+extern "C" Index * create_single_index(const char * path);
+
+/*
+    DRAM baseline: a red-black tree behind a reader-writer lock
+*/
+class MapIndex : public Index {
+private:
+    std::map<int64_t, uint64_t> map_;
+    std::shared_mutex mtx_;
+
+public:
+    void insert(int64_t key, uint64_t val) {
+        std::unique_lock<std::shared_mutex> lock(mtx_);
+        map_[key] = val;
+    }
+
+    uint64_t lookup(int64_t key) {
+        std::shared_lock<std::shared_mutex> lock(mtx_);
+        auto it = map_.find(key);
+        return it == map_.end() ? 0 : it->second;
+    }
+
+    bool update(int64_t key, uint64_t val) {
+        std::unique_lock<std::shared_mutex> lock(mtx_);
+        auto it = map_.find(key);
+        if(it == map_.end()) return false;
+        it->second = val;
+        return true;
+    }
+
+    bool remove(int64_t key) {
+        std::unique_lock<std::shared_mutex> lock(mtx_);
+        return map_.erase(key) > 0;
+    }
+
+    int scan(int64_t start, int len) {
+        std::shared_lock<std::shared_mutex> lock(mtx_);
+        int cnt = 0;
+        uint64_t sum = 0;
+        for(auto it = map_.lower_bound(start); it != map_.end() && cnt < len; ++it, ++cnt)
+            sum += it->second;
+        asm volatile("" : : "r"(sum));
+        return cnt;
+    }
+};
+
+#endif // __INDEX_H__
@@ -0,0 +1,147 @@
+/*  ingest.cc - batches merged by ingest, spread over the key range, packed into a narrow range and
+    appended beyond the largest key, checked against a std::map before and after a clean restart
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+
+#include "tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::map<_key_t, uint64_t> RefMap;
+
+static const int SCAN_LEN = 300;
+
+/*
+ *  lookups of the keys in the reference and of keys next to them, a scan of the whole tree and
+ *  scans from random starts all agree with the reference
+ *  return the number of errors
+ */
+uint64_t check(TLBtree & tree, const RefMap & ref, const char * phase) {
+    uint64_t wrong = 0;
+    for(auto & kv : ref) {
+        wrong += tree.lookup(kv.first) != kv.second;
+        wrong += tree.lookup(kv.first + 1) != 0;
+    }
+
+    // the whole tree, in order and without duplicates
+    Record buf[SCAN_LEN];
+    auto it = ref.begin();
+    size_t scanned = 0;
+    _key_t start = MIN_KEY;
+    while(true) {
+        int n = tree.scan(start, SCAN_LEN, buf);
+        for(int q = 0; q < n; q++) {
+            if(q == 0 && start != MIN_KEY && buf[q].key == start) continue; // the last key of the previous batch
+            wrong += it == ref.end() || buf[q].key != it->first || (uint64_t)buf[q].val != it->second;
+            if(it != ref.end()) ++it;
+            scanned++;
+        }
+        if(n < SCAN_LEN) break;
+        start = buf[n - 1].key;
+    }
+    wrong += scanned != ref.size();
+
+    std::mt19937_64 gen(7);
+    for(int i = 0; i < 1000; i++) {
+        _key_t from = gen() % MAX_KEY;
+        int len = 1 + gen() % SCAN_LEN;
+        int n = tree.scan(from, len, buf);
+        auto rit = ref.lower_bound(from);
+        int q = 0;
+        for(; q < len && rit != ref.end(); q++, ++rit)
+            wrong += q >= n || buf[q].key != rit->first;
+        wrong += n != q;
+    }
+
+    printf("%-22s: %lu records, %lu scanned, %lu wrong results\n", phase, ref.size(), scanned, wrong);
+    return wrong;
+}
+
+// cnt new even keys in [lo, hi) with their values, added to the reference and to the batch
+vector<Record> make_batch(RefMap & ref, std::mt19937_64 & gen, size_t cnt, _key_t lo, _key_t hi) {
+    vector<Record> batch;
+    while(batch.size() < cnt) {
+        _key_t k = lo + gen() % (hi - lo);
+        k -= k % 2;
+        if(ref.emplace(k, k + 1).second) batch.emplace_back(k, (char *)(k + 1));
+    }
+    return batch;
+}
+
+int main(int argc, char ** argv) {
+    string opt_pool = "/mnt/pmem/ingest.pool";
+    uint64_t opt_keys = 200000;
+
+    static const char * optstr = "f:n:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'f':
+            opt_pool = string(optarg);
+            break;
+        case 'n':
+            opt_keys = std::max(atol(optarg), 10000L);
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -f: " << "The pool file, removed before and after the run (default /mnt/pmem/ingest.pool)" << endl;
+            cout << "\t -n: " << "Number of keys (default 200000)" << endl;
+            exit(-1);
+        }
+    }
+
+    uint64_t poolsize = std::max(opt_keys * 4096, 1UL << 30);
+    uint64_t errors = 0;
+    RefMap ref;
+    std::mt19937_64 gen(1);
+    // keys are even, so that the odd keys next to them are never in the tree
+    _key_t span = MAX_KEY / 4;
+    unlink(opt_pool.c_str());
+    {
+        TLBtree tree(opt_pool, poolsize);
+        for(auto & r : make_batch(ref, gen, opt_keys / 4, 2, span))
+            tree.insert(r.key, (uint64_t)r.val);
+        errors += check(tree, ref, "inserted");
+
+        vector<Record> batch = make_batch(ref, gen, 100, 2, span);
+        tree.ingest(batch, 1);
+        errors += check(tree, ref, "small batch");
+
+        batch = make_batch(ref, gen, opt_keys / 4, 2, span);
+        tree.ingest(batch, 4);
+        errors += check(tree, ref, "spread batch");
+
+        // a narrow range splits the same few sub-index trees many times
+        batch = make_batch(ref, gen, opt_keys / 4, span / 2, span / 2 + opt_keys * 16);
+        tree.ingest(batch, 4);
+        errors += check(tree, ref, "narrow batch");
+
+        batch = make_batch(ref, gen, opt_keys / 4, span, span * 2);
+        tree.ingest(batch, 4);
+        errors += check(tree, ref, "appended batch");
+    }
+    {
+        TLBtree tree(opt_pool, poolsize);
+        errors += check(tree, ref, "reopened");
+    }
+    unlink(opt_pool.c_str());
+    return errors == 0 ? 0 : 1;
+}
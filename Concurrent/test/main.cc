@@ -5,78 +5,543 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <filesystem>
 #include <omp.h>
 
 #include "tlbtree.h"
+#include "sharded_tlbtree.h"
+#include "histogram.h"
+#include "workload.h"
+#include "affinity.h"
+#include "index.h"
 
 using std::cout;
 using std::endl;
-using std::ifstream;
 using std::string;
 
-template<typename BtreeType>
-double run_test(std::vector<QueryType> querys, int thread_cnt) {
-    // construct a Btree
-    BtreeType tree("/mnt/pmem/tlbtree.pool");
-    
-    std::atomic_int cur_pos(0);
-    int small_noise = getRandom() & 0xff; // each time we run, we will insert different keys
-    
-    // set the timer
-    #pragma omp barrier
-    auto start = seconds();
+bool opt_stats = false;
+int opt_warmup = 0;         // percent of each thread's slice replayed before the timer starts
+double opt_duration = 0;    // seconds of the measurement window, 0 to replay the workload once
+PinPolicy opt_pin = PIN_NONE;
+std::vector<cpu_info_t> pin_cpus;   // the CPUs taken by thread 0, 1, ... under opt_pin
+std::vector<uint64_t> thread_ops;
+std::vector<double> thread_secs;
+std::vector<int> thread_node;       // the NUMA node each thread ran on
+double remote_ratio = 0;            // estimated fraction of tree accesses to a remote node
+
+static const char * POOL_PATH = "/mnt/pmem/tlbtree.pool";
+
+const int OP_TYPES = OperationType::RMW + 1;
+const char * OP_NAMES[OP_TYPES] = {"read", "insert", "update", "delete", "scan", "rmw"};
+LatencyHistogram latency[OP_TYPES]; // merged from all the threads after the run
+
+void print_latency(double time) {
+    double ns_per_cyc = 1 / pmemu::tsc_per_ns();
+    uint64_t total = 0;
+    cout << "=========LATENCY (ns)=========" << endl;
+    printf("%-8s %10s %10s %8s %8s %8s %8s %10s\n", "op", "count", "Mops/s", "avg", "p50", "p99", "p99.9", "max");
+    for(int op = 0; op < OP_TYPES; op++) {
+        LatencyHistogram & h = latency[op];
+        if(h.count() == 0) continue;
+        total += h.count();
+        printf("%-8s %10lu %10.3f %8.0f %8.0f %8.0f %8.0f %10.0f\n", OP_NAMES[op], h.count(), h.count() / time / 1e6, 
+                h.mean() * ns_per_cyc, h.percentile(50) * ns_per_cyc, h.percentile(99) * ns_per_cyc, 
+                h.percentile(99.9) * ns_per_cyc, h.max() * ns_per_cyc);
+    }
+    printf("%-8s %10lu %10.3f\n", "total", total, total / time / 1e6);
+}
+
+void print_stats(const tlbtree_stats_t & st) {
+    cout << "=========TREE STATS (counters of the measured run)=========" << endl;
+    cout << "sibling chain steps :";
+    for(int i = 0; i < stats::GOES_BUCKETS; i++)
+        cout << " " << i << (i == stats::GOES_BUCKETS - 1 ? "+:" : ":") << st.goes_steps[i];
+    cout << endl;
+    cout << "OLC retries         : down layer " << st.olc_retry_child << ", top layer leaf " << st.olc_retry_leaf << endl;
+    cout << "latch/lock spins    : " << st.latch_spins << " / " << st.lock_spins << endl;
+    cout << "top layer inserts   : " << st.uptree_insert_fails << " failed" << endl;
+    cout << "fast rebuilds       : " << st.rebuild_fast_cnt << " in " << st.rebuild_fast_sec << "s" << endl;
+    cout << "recover rebuilds    : " << st.rebuild_recover_cnt << " in " << st.rebuild_recover_sec << "s" << endl;
+    cout << "compact rebuilds    : " << st.rebuild_compact_cnt << " in " << st.rebuild_compact_sec << "s, "
+         << st.subroots_freed << " empty sub-index trees freed" << endl;
+    cout << "rebuild policy      : " << st.rebuild_policy << ", " << st.chain_hops << " chain steps, "
+         << st.rebuild_deferred << " long walks deferred" << endl;
+    cout << "sub-index heat      : " << st.subtrees_read_hot << " read-hot" << endl;
+    cout << "node merges         : " << st.node_merges << ", " << st.reclaim_pending << " retired awaiting reclamation" << endl;
+    cout << "mutable_ size       : " << st.mutable_size << endl;
+    cout << "top layer           : height " << st.uptree_height << ", " << st.uptree_leaf_cnt 
+         << " leaves, " << st.uptree_leaf_fill * 100 << "% filled, " << st.uptree_live << " live sub-index roots" << endl;
+}
+
+// the counters of now minus those of before, the gauges of now
+tlbtree_stats_t stats_since(const tlbtree_stats_t & now, const tlbtree_stats_t & before) {
+    tlbtree_stats_t st = now;
+    for(int i = 0; i < stats::GOES_BUCKETS; i++)
+        st.goes_steps[i] -= before.goes_steps[i];
+    st.olc_retry_child -= before.olc_retry_child;
+    st.olc_retry_leaf -= before.olc_retry_leaf;
+    st.latch_spins -= before.latch_spins;
+    st.lock_spins -= before.lock_spins;
+    st.uptree_insert_fails -= before.uptree_insert_fails;
+    st.rebuild_fast_cnt -= before.rebuild_fast_cnt;
+    st.rebuild_fast_sec -= before.rebuild_fast_sec;
+    st.rebuild_recover_cnt -= before.rebuild_recover_cnt;
+    st.rebuild_recover_sec -= before.rebuild_recover_sec;
+    st.rebuild_compact_cnt -= before.rebuild_compact_cnt;
+    st.rebuild_compact_sec -= before.rebuild_compact_sec;
+    st.subroots_freed -= before.subroots_freed;
+    st.chain_hops -= before.chain_hops;
+    st.rebuild_deferred -= before.rebuild_deferred;
+    st.node_merges -= before.node_merges;
+    return st;
+}
+
+template<int DOWNLEVEL, int REBUILD_THRESHOLD>
+class TLBtreeIndex : public Index {
+protected:
+    TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD> * tree_;
+    tlbtree_stats_t mark_;   // the stats when the timer started, so loading and warm-up are left out
+
+public:
+    TLBtreeIndex(const char * path, uint64_t poolsize = POOL_SIZE) {
+        tree_ = new TLBtreeImpl<DOWNLEVEL, REBUILD_THRESHOLD>(path, file_exist(path), poolsize);
+        mark_ = tree_->stats();
+    }
+
+    ~TLBtreeIndex() { delete tree_; }
+
+    void insert(int64_t key, uint64_t val) { tree_->insert(key, val); }
+
+    uint64_t lookup(int64_t key) {
+        uint64_t val;
+        return tree_->find(key, val) ? val : 0;
+    }
+
+    bool update(int64_t key, uint64_t val) { return tree_->update(key, val); }
+    bool remove(int64_t key) { return tree_->remove(key); }
+
+    int scan(int64_t start, int len) {
+        static thread_local std::vector<Record> buf;
+        if((int)buf.size() < len) buf.resize(len);
+        return tree_->scan(start, len, buf.data());
+    }
+
+    void sample_blocks(std::vector<void *> & addrs, size_t cnt) {
+        PMAllocator * alc = tree_->allocator();
+        size_t used = alc->used_blocks();
+        for(size_t i = 0; i < std::min(used, cnt); i++)
+            addrs.push_back(alc->block_addr(used * i / std::min(used, cnt)));
+    }
+
+    void mark_stats() { mark_ = tree_->stats(); }
+    void print_stats() { ::print_stats(stats_since(tree_->stats(), mark_)); }
+};
+
+// the original rebuild trigger, for comparison with the default cost model
+class StepTLBtreeIndex : public TLBtreeIndex<2, 2> {
+public:
+    StepTLBtreeIndex(const char * path): TLBtreeIndex<2, 2>(path) {
+        tree_->set_rebuild_policy(new StepRebuildPolicy(2));
+    }
+};
+
+// SHARDS shards split evenly over the key space, each in a pool beside path (path.0, path.1, ...)
+// and, on a NUMA machine, on the nodes in turn
+class ShardedIndex : public Index {
+private:
+    static const int SHARDS = 4;
+    ShardedTLBtree * tree_;
+    tlbtree_stats_t mark_[SHARDS];
+
+    static std::vector<shard_config_t> configs(const char * path) {
+        std::vector<shard_config_t> cfgs;
+        int nodes = numa::node_cnt();
+        for(int s = 0; s < SHARDS; s++)
+            cfgs.emplace_back(string(path) + "." + std::to_string(s), nodes > 1 ? s % nodes : -1);
+        return cfgs;
+    }
+
+public:
+    ShardedIndex(const char * path) {
+        tree_ = new ShardedTLBtree(configs(path));
+        mark_stats();
+    }
+
+    ~ShardedIndex() { delete tree_; }
+
+    static void remove_pools(const char * path) {
+        for(auto & c : configs(path))
+            unlink(c.path.c_str());
+        unlink((configs(path)[0].path + ".splits").c_str());
+    }
+
+    void insert(int64_t key, uint64_t val) { tree_->insert(key, val); }
+    uint64_t lookup(int64_t key) { return tree_->lookup(key); }
+    bool update(int64_t key, uint64_t val) { return tree_->update(key, val); }
+    bool remove(int64_t key) { return tree_->remove(key); }
+
+    int scan(int64_t start, int len) {
+        static thread_local std::vector<Record> buf;
+        if((int)buf.size() < len) buf.resize(len);
+        return tree_->scan(start, len, buf.data());
+    }
+
+    void sample_blocks(std::vector<void *> & addrs, size_t cnt) {
+        for(int s = 0; s < SHARDS; s++) {
+            PMAllocator * alc = tree_->shard(s)->allocator();
+            size_t used = alc->used_blocks(), n = std::min(used, cnt / SHARDS);
+            for(size_t i = 0; i < n; i++)
+                addrs.push_back(alc->block_addr(used * i / n));
+        }
+    }
+
+    void mark_stats() {
+        for(int s = 0; s < SHARDS; s++)
+            mark_[s] = tree_->stats(s);
+    }
+
+    void print_stats() {
+        for(int s = 0; s < SHARDS; s++) {
+            cout << "shard " << s << endl;
+            ::print_stats(stats_since(tree_->stats(s), mark_[s]));
+        }
+    }
+};
+
+struct index_type_t {
+    const char * name;
+    const char * desc;
+    Index * (* create)(const char * path);
+};
+
+template<typename T>
+Index * create_index(const char * path) { return new T(path); }
+
+static const index_type_t INDEX_TYPES[] = {
+    {"tlbtree",    "TLBtreeImpl<2,2>, the default",               create_index<TLBtreeIndex<2, 2>>},
+    {"tlbtree-d3", "TLBtreeImpl<3,2>, taller sub-indexes",        create_index<TLBtreeIndex<3, 2>>},
+    {"tlbtree-r8", "TLBtreeImpl<2,8>, longer sibling chains",     create_index<TLBtreeIndex<2, 8>>},
+    {"tlbtree-step", "TLBtreeImpl<2,2>, rebuild on any walk of 3+ steps", create_index<StepTLBtreeIndex>},
+    {"sharded",    "ShardedTLBtree, 4 TLBtreeImpl<2,2> shards in pools path.0 to path.3", create_index<ShardedIndex>},
+    {"single",     "the Single variant, run with one thread",     create_single_index},
+    {"map",        "std::map with a reader-writer lock, in DRAM", [](const char *) -> Index * { return new MapIndex; }},
+};
+
+const index_type_t * find_index_type(const string & name) { // NULL if there is no such type
+    for(auto & it : INDEX_TYPES)
+        if(name == it.name) return &it;
+    return NULL;
+}
+
+inline void execute(Index & tree, const QueryType & q) {
+    _key_t key = q.key;
+    uint64_t val = (uint64_t)key;
+    switch (q.op) {
+        case OperationType::READ: {
+            // may miss if its key is being inserted by another thread (latest distribution)
+            tree.lookup(key);
+            break;
+        }
+        case OperationType::INSERT: {
+            // datagen draws new insert keys each time, so that reads of them (YCSB D) hit
+            tree.insert(key, val);
+            break;
+        }
+        case OperationType::UPDATE: {
+            auto r = tree.update(key, val);
+            assert(r);
+            break;
+        }
+        case OperationType::DELETE: {
+            auto r = tree.remove(key);
+            assert(r);
+            break;
+        }
+        case OperationType::SCAN: {
+            auto cnt = tree.scan(key, q.len);
+            assert(cnt != 0);
+            break;
+        }
+        case OperationType::RMW: {
+            auto v = tree.lookup(key);
+            auto r = tree.update(key, v + 1);
+            assert(r);
+            break;
+        }
+        default:
+            std::cout << "Error: unknown operation!" << std::endl;
+            exit(0);
+            break;
+    }
+}
+
+double estimate_remote(Index & tree) {
+    // sample the nodes of the allocated blocks and weight each thread's share of remote pages by its ops
+    std::vector<void *> pages;
+    tree.sample_blocks(pages, 1024);
+    std::vector<int> nodes = page_nodes(pages);
+
+    double remote = 0, total = 0;
+    for(size_t t = 0; t < thread_ops.size(); t++) {
+        size_t valid = 0, away = 0;
+        for(int n : nodes) {
+            if(n < 0) continue;
+            valid++;
+            away += (n != thread_node[t]);
+        }
+        if(valid == 0) continue;
+        remote += thread_ops[t] * (double)away / valid;
+        total += thread_ops[t];
+    }
+    return total == 0 ? 0 : remote / total;
+}
+
+double run_test(Index & tree, const WorkloadFile & workload, int thread_cnt) {
+    const QueryType * querys = workload.data();
+    uint64_t deadline = 0; // the TSC at which a fixed-duration run stops
+    double start = 0;
+
+    thread_ops.assign(thread_cnt, 0);
+    thread_secs.assign(thread_cnt, 0);
+    thread_node.assign(thread_cnt, 0);
 
     // start the section of parallel 
     #pragma omp parallel num_threads(thread_cnt)
     {
-        #pragma omp for schedule(static)
-        for (size_t i = 0; i < querys.size(); ++i) {
-            // get a unique query from querys
-            int obtain_pos = cur_pos.fetch_add(1, std::memory_order_relaxed);
-            OperationType op = querys[obtain_pos].op;
-            _key_t key = querys[obtain_pos].key;
-            uint64_t val = (uint64_t)key;
-
-            switch (op) {
-                case OperationType::READ: {
-                    auto val = tree.lookup(key);
-                    assert(val != 0);
-                    break;
-                }
-                case OperationType::INSERT: {
-                    tree.insert(key + small_noise, uint64_t((uint64_t)val + small_noise));
-                    break;
-                }
-                case OperationType::UPDATE: {
-                    auto r = tree.update(key, val);
-                    assert(r);
-                    break;
-                }
-                case OperationType::DELETE: {
-                    auto r = tree.remove(key);
-                    assert(r);
-                    break;
-                }
-                default:
-                    std::cout << "Error: unknown operation!" << std::endl;
-                    exit(0);
-                    break;
+        LatencyHistogram * hist = new LatencyHistogram[OP_TYPES]; // per-thread latency of each operation type
+        int tid = omp_get_thread_num();
+        if(!pin_cpus.empty())
+            pin_thread(pin_cpus[tid % pin_cpus.size()].cpu);
+
+        // each thread replays its own contiguous slice of the workload, the head of it warms up
+        uint64_t begin, end;
+        WorkloadFile::slice(workload.size(), tid, omp_get_num_threads(), begin, end);
+        uint64_t warm_end = begin + (end - begin) * opt_warmup / 100;
+        for (uint64_t i = begin; i < warm_end; ++i)
+            execute(tree, querys[i]);
+
+        // set the timer when all the threads are warm
+        #pragma omp barrier
+        #pragma omp single
+        {
+            if(meter_enabled) meter_reset();
+            tree.mark_stats();
+            if(opt_duration > 0)
+                deadline = _rdtsc() + (uint64_t)(opt_duration * 1e9 * pmemu::tsc_per_ns());
+            start = seconds();
+        }
+
+        double thread_start = seconds();
+        uint64_t ops = 0;
+        bool replay = false;    // past the first pass, only the reads and scans are repeated
+        uint64_t replayed = 0;  // ops run in the current pass
+        for (uint64_t i = warm_end; ; ++i) {
+            if(i == end) {
+                // a fixed-duration run replays the measured part of the slice again, the writes
+                // would insert keys present, delete keys gone and update deleted keys
+                if(deadline == 0 || replayed == 0) break;
+                i = warm_end;
+                replay = true;
+                replayed = 0;
             }
+            if(replay && querys[i].op != OperationType::READ && querys[i].op != OperationType::SCAN)
+                continue;
+            replayed++;
+
+            uint64_t op_start = _rdtsc();
+            execute(tree, querys[i]);
+            uint64_t op_end = _rdtsc();
+            hist[querys[i].op].record(op_end - op_start);
+            ops++;
+
+            if(deadline != 0 && op_end >= deadline) break;
+        }
+        thread_secs[tid] = seconds() - thread_start;
+        thread_ops[tid] = ops;
+        thread_node[tid] = cpu_node(sched_getcpu());
+
+        #pragma omp critical
+        {
+            for(int op = 0; op < OP_TYPES; op++)
+                latency[op].merge(hist[op]);
         }
+        delete [] hist;
     }
 
-    #pragma omp barrier
     auto end = seconds();
 
+    remote_ratio = estimate_remote(tree);
+    if(opt_stats)
+        tree.print_stats();
+
     return end - start;
 }
 
+void print_threads() {
+    int cnt = thread_ops.size();
+    double sum = 0, lo = 0, hi = 0;
+    cout << "=========THREADS=========" << endl;
+    printf("%-8s %12s %10s\n", "thread", "ops", "Mops/s");
+    for(int t = 0; t < cnt; t++) {
+        double tput = thread_secs[t] > 0 ? thread_ops[t] / thread_secs[t] / 1e6 : 0;
+        printf("%-8d %12lu %10.3f\n", t, thread_ops[t], tput);
+        sum += tput;
+        lo = (t == 0 ? tput : std::min(lo, tput));
+        hi = std::max(hi, tput);
+    }
+    printf("min %.3f, max %.3f, avg %.3f Mops/s per thread\n", lo, hi, cnt == 0 ? 0 : sum / cnt);
+}
+
+void load_index(Index & tree, const std::vector<_key_t> & keys, int thread_cnt) {
+    #pragma omp parallel for schedule(static) num_threads(tree.concurrent() ? thread_cnt : 1)
+    for(size_t i = 0; i < keys.size(); i++)
+        tree.insert(keys[i], (uint64_t)keys[i]);
+}
+
+std::vector<_key_t> read_dataset(const string & dataset) { // at most LOADSCALE million keys
+    std::vector<_key_t> keys;
+    std::ifstream fin(dataset, std::ios::binary | std::ios::ate);
+    if(fin) {
+        keys.resize(std::min((uint64_t)fin.tellg() / sizeof(_key_t), (uint64_t)LOADSCALE * MILLION));
+        fin.seekg(0);
+        fin.read((char *)keys.data(), keys.size() * sizeof(_key_t));
+    } else {
+        cout << "dataset " << dataset << " not openned, the indexes start empty" << endl;
+    }
+    return keys;
+}
+
+string bench_pool(const string & name) { // the pool of index type name, whose files are removed
+    string path = "/mnt/pmem/bench-" + name + ".pool";
+    unlink(path.c_str());
+    ShardedIndex::remove_pools(path.c_str());
+    return path;
+}
+
+void run_sweep(const WorkloadFile & workload, int max_thread, int step, const index_type_t * type, const string & dataset) {
+    /* every point starts from the same tree: without a type, the default tree in POOL_PATH,
+        restored from a snapshot (or removed); with one, an empty index loaded with the dataset */
+    string snapshot = string(POOL_PATH) + ".sweep";
+    bool preloaded = type == NULL && file_exist(POOL_PATH);
+    if(preloaded)
+        std::filesystem::copy_file(POOL_PATH, snapshot, std::filesystem::copy_options::overwrite_existing);
+    std::vector<_key_t> keys;
+    if(type != NULL)
+        keys = read_dataset(dataset);
+
+    std::vector<int> points = {1};
+    for(int t = step; t <= max_thread; t += step)
+        if(t > 1) points.push_back(t);
+    if(points.back() != max_thread) points.push_back(max_thread);
+
+    cout << "=========SWEEP (" << (type == NULL ? "tlbtree" : type->name) << ", pinning: " << PIN_NAMES[opt_pin] << ")=========" << endl;
+    printf("%-8s %10s %12s %10s %10s\n", "threads", "Mops/s", "Mops/s/thd", "efficiency", "remote");
+    double base = 0;
+    for(int t : points) {
+        double time;
+        if(type == NULL) {
+            if(preloaded)
+                std::filesystem::copy_file(snapshot, POOL_PATH, std::filesystem::copy_options::overwrite_existing);
+            else
+                std::filesystem::remove(POOL_PATH);
+            for(auto & h : latency) h.reset();
+
+            TLBtreeIndex<2, 2> tree(POOL_PATH);
+            time = run_test(tree, workload, t);
+        } else {
+            string path = bench_pool(type->name);
+            Index * tree = type->create(path.c_str());
+            if(!tree->concurrent()) {
+                cout << type->name << " runs with one thread only" << endl;
+                delete tree;
+                bench_pool(type->name);
+                break;
+            }
+            load_index(*tree, keys, t);
+            for(auto & h : latency) h.reset();
+
+            time = run_test(*tree, workload, t);
+            delete tree;
+            bench_pool(type->name);
+        }
+        uint64_t ops = 0;
+        for(auto n : thread_ops) ops += n;
+        double tput = ops / time / 1e6;
+        if(base == 0) base = tput / t;
+        printf("%-8d %10.3f %12.3f %9.1f%% %9.1f%%\n", t, tput, tput / t, tput / t / base * 100, remote_ratio * 100);
+    }
+    if(preloaded)
+        std::filesystem::remove(snapshot);
+}
+
+void run_compare(const WorkloadFile & workload, const string & names, int thread_cnt, const string & dataset) {
+    // every index starts from an empty pool loaded with the same dataset
+    std::vector<_key_t> keys = read_dataset(dataset);
+
+    std::vector<string> rows;
+    size_t pos = 0;
+    while(pos <= names.size()) {
+        size_t comma = std::min(names.find(',', pos), names.size());
+        string name = names.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        const index_type_t * type = find_index_type(name);
+        if(type == NULL) {
+            cout << "unknown index type " << name << endl;
+            continue;
+        }
+
+        string path = bench_pool(name);
+        Index * tree = type->create(path.c_str());
+        int t = tree->concurrent() ? thread_cnt : 1;
+        load_index(*tree, keys, t);
+
+        for(auto & h : latency) h.reset();
+        double time = run_test(*tree, workload, t);
+        delete tree;
+        bench_pool(name);
+
+        LatencyHistogram all;
+        for(auto & h : latency) all.merge(h);
+        double ns_per_cyc = 1 / pmemu::tsc_per_ns();
+        char row[256];
+        snprintf(row, sizeof(row), "%-12s %8d %10.3f %8.0f %8.0f %8.0f %8.0f", name.c_str(), t, all.count() / time / 1e6,
+                all.mean() * ns_per_cyc, all.percentile(50) * ns_per_cyc, all.percentile(99) * ns_per_cyc, 
+                all.percentile(99.9) * ns_per_cyc);
+        rows.push_back(row);
+    }
+
+    cout << "=========COMPARISON (latency in ns)=========" << endl;
+    printf("%-12s %8s %10s %8s %8s %8s %8s\n", "index", "threads", "Mops/s", "avg", "p50", "p99", "p99.9");
+    for(auto & r : rows)
+        cout << r << endl;
+}
+
+void print_persist_cost() {
+    meter::counter_t cost[meter::OP_TYPES];
+    meter_report(cost);
+
+    cout << "=========PERSIST COST=========" << endl;
+    printf("%-8s %10s %9s %9s %9s %9s %9s %9s\n", "op", "count", "lines", "fences", "xplines", "WA", "splits", "upinsert");
+    for(int op = 0; op < meter::OP_TYPES; op++) {
+        meter::counter_t & c = cost[op];
+        if(c.ops == 0) continue;
+        double n = c.ops;
+        // write amplification: bytes written back per 16B key-value record
+        printf("%-8s %10lu %9.3f %9.3f %9.3f %9.2f %9.4f %9.4f\n", meter::OP_NAMES[op], c.ops, c.lines / n, 
+                c.fences / n, c.xplines / n, c.lines * CACHE_LINE_SIZE / n / sizeof(Record), c.splits / n, c.upinserts / n);
+    }
+    cout << "(all but count are per operation)" << endl;
+}
 
 int main(int argc, char ** argv) {
-    string opt_fname = "../build/workload.txt";
+    string opt_fname = "../build/workload.dat";
     int opt_num_thread = 1;
+    int opt_sweep_max = 0, opt_sweep_step = 1;
+    string opt_index = "";
+    string opt_dataset = "dataset.dat";
 
-    static const char * optstr = "f:t:h";
+    static const char * optstr = "f:t:e:m:w:d:p:S:i:l:ncsh";
     opterr = 0;
     char opt;
     while((opt = getopt(argc, argv, optstr)) != -1) {
@@ -88,33 +553,121 @@ int main(int argc, char ** argv) {
             if(atoi(optarg) > 0)
                 opt_num_thread = atoi(optarg);
             break;
+        case 'n':
+            use_ntstore = true;
+            break;
+        case 'e':
+            if(!set_persist_domain(optarg)) {
+                cout << "unknown persistence domain " << optarg << endl;
+                goto usage;
+            }
+            break;
+        case 's':
+            opt_stats = true;
+            break;
+        case 'w':
+            opt_warmup = std::min(std::max(atoi(optarg), 0), 100);
+            break;
+        case 'd':
+            opt_duration = atof(optarg);
+            break;
+        case 'p': {
+            int p = PIN_NONE;
+            while(p <= PIN_SOCKET && string(optarg) != PIN_NAMES[p]) p++;
+            if(p > PIN_SOCKET) {
+                cout << "unknown pinning policy " << optarg << endl;
+                goto usage;
+            }
+            opt_pin = (PinPolicy)p;
+            break;
+        }
+        case 'S':
+            opt_sweep_max = atoi(optarg);
+            if(strchr(optarg, ':') != NULL)
+                opt_sweep_step = std::max(atoi(strchr(optarg, ':') + 1), 1);
+            break;
+        case 'i':
+            opt_index = string(optarg);
+            break;
+        case 'l':
+            opt_dataset = string(optarg);
+            break;
+        case 'c':
+            meter_enabled = true;
+            break;
+        case 'm':
+            if(!pmemu_configure(optarg)) {
+                cout << "unknown PM emulation profile " << optarg << endl;
+                exit(-1);
+            }
+            break;
         case '?':
         case 'h':
         default:
+        usage:
             cout << "USAGE: "<< argv[0] << "[option]" << endl;
             cout << "\t -h: " << "Print the USAGE" << endl;
-            cout << "\t -f: " << "Filename of the workload" << endl;
+            cout << "\t -f: " << "Filename of the workload, binary or text" << endl;
             cout << "\t -t: " << "Number of Threads to excute the workload" << endl;
-            cout << "\t -i: " << "The index tree type" << endl;
+            cout << "\t -i: " << "Compare index types, comma separated, each loaded from the dataset:" << endl;
+            for(auto & it : INDEX_TYPES)
+                cout << "\t     " << it.name << ": " << it.desc << endl;
+            cout << "\t -l: " << "The dataset loaded for -i (default: dataset.dat)" << endl;
+            cout << "\t -n: " << "Write new nodes with non-temporal stores (default: clwb)" << endl;
+            cout << "\t -e: " << "Persistence domain: adr, eadr (flushes elided) or auto (default)" << endl;
+            cout << "\t -m: " << "Emulate PM latency and bandwidth on DRAM: optane100, optane100-1dimm, optane200" << endl;
+            cout << "\t -c: " << "Count the persistence cost of each operation type" << endl;
+            cout << "\t -s: " << "Print the statistics of the tree after the run" << endl;
+            cout << "\t -w: " << "Percent of the workload replayed as warm-up before the timer (default 0)" << endl;
+            cout << "\t -d: " << "Measure for a fixed number of seconds, replaying the reads and scans if needed" << endl;
+            cout << "\t -p: " << "Pin threads to CPUs: none (default), compact, scatter or socket" << endl;
+            cout << "\t -S: " << "Sweep thread counts max[:step], from 1 and then every step threads, of the index type given by -i" << endl;
             exit(-1);
             break;
         }
     }
 
-    ifstream fin(opt_fname.c_str());
-    if(!fin) {
+    WorkloadFile workload;
+    if(!workload.open(opt_fname.c_str())) {
         cout << "workload file not openned" << endl;
         exit(-1);
     }
-    std::vector<QueryType> querys;
-    int op;
-    _key_t key;
-    while(fin >> op >> key) {
-        querys.push_back({(OperationType)op, key});
+    cout << "flush instruction: " << flush_name() << endl;
+    cout << "persistence domain: " << persist_domain_name() << endl;
+    if(pmemu_cfg.enabled)
+        cout << "PM emulation: " << pmemu_cfg.name << endl;
+    pin_cpus = pin_order(opt_pin);
+    if(opt_sweep_max > 0) {
+        // -i names the one index type to sweep
+        const index_type_t * type = NULL;
+        if(opt_index != "") {
+            type = find_index_type(opt_index);
+            if(type == NULL) {
+                cout << "unknown index type " << opt_index << ", -S sweeps one index type" << endl;
+                exit(-1);
+            }
+        }
+        run_sweep(workload, opt_sweep_max, opt_sweep_step, type, opt_dataset);
+        return 0;
+    }
+    if(opt_index != "") {
+        run_compare(workload, opt_index, opt_num_thread, opt_dataset);
+        return 0;
+    }
+
+    double time;
+    {
+        TLBtreeIndex<2, 2> tree(POOL_PATH);
+        time = run_test(tree, workload, opt_num_thread);
     }
-    double time = run_test<TLBtree>(querys, opt_num_thread);
 
     cout << time << endl;
+    print_latency(time);
+    print_threads();
+    if(pin_cpus.size() > 0 || remote_ratio > 0)
+        printf("pinning: %s, NUMA remote: %.1f%%\n", PIN_NAMES[opt_pin], remote_ratio * 100);
+    if(meter_enabled)
+        print_persist_cost();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+
+#include "tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+using wotree256::Node;
+using wotree256::state_t;
+using wotree256::CARDINALITY;
+
+static const char * POOL_PATH = "/mnt/pmem/microbench.pool";
+static constexpr uint64_t MB_POOL_SIZE = 2048UL * 1024 * 1024;
+static PMAllocator * alc; // the pool of all the kernels
+
+template<typename T>
+inline void keep(const T & v) { // keep the compiler from dropping a result
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+int opt_reps = 5;
+
+/*
+ *  Time a kernel: run it iters times, repeat opt_reps times and report the fastest round,
+ *  setup() runs before each round and is not timed
+ */
+template<typename S, typename F>
+void bench(const char * name, uint64_t iters, S setup, F kernel) {
+    uint64_t best = UINT64_MAX;
+    for(int r = 0; r < opt_reps; r++) {
+        setup();
+        uint64_t start = _rdtsc();
+        for(uint64_t i = 0; i < iters; i++)
+            kernel(i);
+        best = std::min(best, (uint64_t)(_rdtsc() - start));
+    }
+    printf("%-36s %10.2f ns\n", name, best / pmemu::tsc_per_ns() / iters);
+}
+
+template<typename F>
+void bench(const char * name, uint64_t iters, F kernel) {
+    bench(name, iters, []{}, kernel);
+}
+
+namespace fixtree {
+struct fixtree_bench {
+    static int inner_search(const Fixtree & t, int node_idx, _key_t key) { return t.inner_search(node_idx, key); }
+    static char ** leaf_search(const Fixtree & t, int node_idx, _key_t key) { return t.leaf_search(node_idx, key); }
+};
+} // namespace fixtree
+
+void bench_state() {
+    cout << "---- state_t ----" << endl;
+    std::mt19937 gen(7);
+    state_t full;
+    for(int i = 0; i < CARDINALITY - 1; i++) // 12 slots taken in random positions
+        full.pack = full.add(gen() % (full.unpack.count + 1), full.alloc());
+    int8_t cnt = full.unpack.count;
+
+    bench("state_t::read", 1 << 24, [&](uint64_t i) { keep(full.read(i % cnt)); });
+    bench("state_t::add", 1 << 24, [&](uint64_t i) { keep(full.add(i % cnt, 12)); });
+    bench("state_t::remove", 1 << 24, [&](uint64_t i) { keep(full.remove(i % cnt)); });
+    bench("state_t::alloc", 1 << 24, [&](uint64_t i) {
+        full.unpack.slotArray ^= (i & 1); // defeat hoisting, slot ids stay distinct
+        keep(full.alloc());
+    });
+}
+
+void bench_node() {
+    cout << "---- wotree256::Node ----" << endl;
+    const int NODES = 4096;
+    const int FILL = CARDINALITY - 1; // stores that do not split
+    std::mt19937_64 gen(11);
+    vector<Node *> leaves(NODES), inners(NODES);
+    vector<_key_t> keys(NODES * CARDINALITY);
+    for(auto & k : keys) k = (gen() >> 1) | 1;
+    for(int n = 0; n < NODES; n++) {
+        leaves[n] = ::new (alc->malloc(sizeof(Node))) Node;
+        inners[n] = ::new (alc->malloc(sizeof(Node))) Node;
+        inners[n]->leftmost_ptr_ = (char *)alc->relative(leaves[n]);
+        std::sort(keys.begin() + n * CARDINALITY, keys.begin() + (n + 1) * CARDINALITY);
+    }
+    auto reset = [&](vector<Node *> & nodes) {
+        for(auto n : nodes) n->state_.pack = 0;
+    };
+
+    _key_t split_k; Node * split_node;
+    bench("Node::store (no split)", NODES * FILL, [&]{ reset(leaves); }, [&](uint64_t i) {
+        int n = i / FILL;
+        leaves[n]->store(alc, keys[n * CARDINALITY + (i * 7) % FILL], i, split_k, split_node);
+    });
+    bench("Node::insertone (inner)", NODES * FILL, [&]{ reset(inners); }, [&](uint64_t i) {
+        int n = i / FILL;
+        inners[n]->insertone(keys[n * CARDINALITY + (i * 7) % FILL], (char *)i);
+        PersistBatch::local().flush();
+    });
+
+    // fill every node with all its keys
+    reset(leaves); reset(inners);
+    for(int n = 0; n < NODES; n++) {
+        for(int j = 0; j < FILL; j++) {
+            leaves[n]->store(alc, keys[n * CARDINALITY + j], j + 1, split_k, split_node);
+            inners[n]->insertone(keys[n * CARDINALITY + j], (char *)alc->relative(leaves[n]));
+        }
+    }
+    PersistBatch::local().flush();
+    bench("Node::get_child (leaf)", 1 << 22, [&](uint64_t i) {
+        int n = (i * 2654435761u) % NODES;
+        keep(leaves[n]->get_child(alc, keys[n * CARDINALITY + i % FILL]));
+    });
+    bench("Node::get_child (inner)", 1 << 22, [&](uint64_t i) {
+        int n = (i * 2654435761u) % NODES;
+        keep(inners[n]->get_child(alc, keys[n * CARDINALITY + i % FILL] + 1));
+    });
+
+    // store into full nodes, each store splits and allocates a node
+    for(int n = 0; n < NODES; n++)
+        leaves[n]->store(alc, keys[n * CARDINALITY + FILL], FILL + 1, split_k, split_node);
+    vector<uint64_t> full_state(NODES);
+    for(int n = 0; n < NODES; n++) full_state[n] = leaves[n]->state_.pack;
+    bench("Node::store (split)", NODES, [&]{
+        for(int n = 0; n < NODES; n++) leaves[n]->state_.pack = full_state[n];
+    }, [&](uint64_t i) {
+        leaves[i]->store(alc, keys[i * CARDINALITY] + 1, 1, split_k, split_node);
+    });
+}
+
+void bench_fixtree() {
+    cout << "---- fixtree::Fixtree ----" << endl;
+    const int SUBROOTS = 1 << 20;
+    vector<Record> recs(SUBROOTS);
+    for(int i = 0; i < SUBROOTS; i++)
+        recs[i] = Record((_key_t)i * 4096, (char *)(uint64_t)(i + 1));
+    fixtree::Fixtree tree(alc, recs);
+
+    std::mt19937_64 gen(13);
+    vector<_key_t> probes(1 << 16);
+    for(auto & k : probes) k = gen() % ((_key_t)SUBROOTS * 4096);
+
+    bench("Fixtree::inner_search (root)", 1 << 22, [&](uint64_t i) {
+        keep(fixtree::fixtree_bench::inner_search(tree, 0, probes[i & 0xffff]));
+    });
+    bench("Fixtree::leaf_search", 1 << 22, [&](uint64_t i) {
+        _key_t k = probes[i & 0xffff];
+        keep(fixtree::fixtree_bench::leaf_search(tree, k / 4096 / fixtree::LEAF_REBUILD_CARD, k));
+    });
+    bench("Fixtree::find_lower", 1 << 22, [&](uint64_t i) {
+        keep(tree.find_lower(probes[i & 0xffff]));
+    });
+}
+
+void bench_malloc() {
+    cout << "---- PMAllocator::malloc (256B) ----" << endl;
+    const int PER_THREAD = 1 << 16;
+    int max_thread = std::max(1u, std::thread::hardware_concurrency());
+    for(int t = 1; ; t = std::min(t * 2, max_thread)) {
+        uint64_t start = _rdtsc();
+        vector<std::thread> threads;
+        for(int i = 0; i < t; i++) {
+            threads.emplace_back([]{
+                for(int j = 0; j < PER_THREAD; j++)
+                    keep(alc->malloc(256));
+            });
+        }
+        for(auto & th : threads) th.join();
+        double ns = (_rdtsc() - start) / pmemu::tsc_per_ns();
+        string name = std::to_string(t) + " thread(s)";
+        printf("%-36s %10.2f ns per malloc, %.2f M mallocs/s\n", name.c_str(), ns / PER_THREAD,
+                (double)t * PER_THREAD / ns * 1e3);
+        if(t == max_thread) break;
+    }
+}
+
+void bench_flush() {
+    cout << "---- persistence (" << flush_name() << ", " << persist_domain_name() << ") ----" << endl;
+    const int LINES = 1 << 16; // 4MB, larger than the private caches
+    char * buf = (char *)alc->malloc(LINES * CACHE_LINE_SIZE);
+    memset(buf, 0, LINES * CACHE_LINE_SIZE);
+    auto line = [&](uint64_t i) { return buf + (i * 97 % LINES) * CACHE_LINE_SIZE; };
+
+    bench("clwb (dirty line, no fence)", LINES, [&](uint64_t i) {
+        char * l = line(i);
+        l[0]++;
+        clwb(l, 8);
+    });
+    mfence();
+    bench("clwb + sfence", LINES, [&](uint64_t i) {
+        char * l = line(i);
+        l[0]++;
+        clwb(l, 8);
+        mfence();
+    });
+    bench("persist_assign + sfence", LINES, [&](uint64_t i) {
+        uint64_t * p = (uint64_t *)line(i);
+        persist_assign(p, i);
+        mfence();
+    });
+    bench("PersistBatch 4 lines + fence", LINES / 4, [&](uint64_t i) {
+        PersistBatch & pb = PersistBatch::local();
+        char * l = buf + (i * 4 * 97 % LINES) / 4 * 4 * CACHE_LINE_SIZE; // 4 lines in one XPLine
+        for(int j = 0; j < 4; j++)
+            pb.assign((uint64_t *)(l + j * CACHE_LINE_SIZE), i);
+        pb.fence();
+    });
+    alignas(CACHE_LINE_SIZE) char img[256] = {0};
+    bench("ntstore 256B + sfence", LINES / 4, [&](uint64_t i) {
+        img[0] = i;
+        ntstore(buf + (i * 4 * 97 % LINES) / 4 * 4 * CACHE_LINE_SIZE, img, sizeof(img));
+        mfence();
+    });
+}
+
+int main(int argc, char ** argv) {
+    string opt_only = "";
+
+    static const char * optstr = "k:r:e:m:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'k':
+            opt_only = string(optarg);
+            break;
+        case 'r':
+            opt_reps = std::max(atoi(optarg), 1);
+            break;
+        case 'e':
+            if(string(optarg) == "adr")
+                set_persist_domain(PERSIST_ADR);
+            else if(string(optarg) == "eadr")
+                set_persist_domain(PERSIST_EADR);
+            break;
+        case 'm':
+            if(!pmemu_configure(optarg)) {
+                cout << "unknown PM emulation profile " << optarg << endl;
+                exit(-1);
+            }
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -k: " << "Only run one group: state, node, fixtree, malloc or flush" << endl;
+            cout << "\t -r: " << "Rounds of each kernel, the fastest is reported (default 5)" << endl;
+            cout << "\t -e: " << "Persistence domain: adr, eadr (flushes elided) or auto (default)" << endl;
+            cout << "\t -m: " << "Emulate PM latency and bandwidth on DRAM: optane100, optane100-1dimm, optane200" << endl;
+            exit(-1);
+        }
+    }
+
+    unlink(POOL_PATH);
+    alc = new PMAllocator(POOL_PATH, false, "microbench", MB_POOL_SIZE);
+
+    if(opt_only == "" || opt_only == "state")   bench_state();
+    if(opt_only == "" || opt_only == "node")    bench_node();
+    if(opt_only == "" || opt_only == "fixtree") bench_fixtree();
+    if(opt_only == "" || opt_only == "malloc")  bench_malloc();
+    if(opt_only == "" || opt_only == "flush")   bench_flush();
+
+    delete alc;
+    unlink(POOL_PATH);
+    return 0;
+}
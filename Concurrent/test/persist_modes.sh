@@ -0,0 +1,19 @@
+#!/bin/bash
+# run the same workload under ADR (clwb on every persist) and eADR (flushes elided)
+# usage: ./persist_modes.sh [workload file] [threads]
+
+workload=$1
+threads=$2
+if [ $# -lt 1 ]; then
+    workload=workload.dat
+fi
+if [ $# -lt 2 ]; then
+    threads=1
+fi
+
+for mode in adr eadr; do
+    rm -f /mnt/pmem/tlbtree.pool
+    ./preload $threads dram $mode > /dev/null # the tree is loaded under the mode it is measured in
+    echo "==== $mode ===="
+    ./main -f $workload -t $threads -e $mode
+done
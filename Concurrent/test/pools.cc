@@ -0,0 +1,100 @@
+/*  pools.cc - a tree over two pools whose first one is too small for it, so that allocations
+    fall back to pool 1, checked across a clean restart
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+
+#include "tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// the number of keys found with their values, of those in keys[lo, hi)
+uint64_t count_found(TLBtree & tree, const vector<_key_t> & keys, size_t lo, size_t hi) {
+    uint64_t found = 0;
+    for(size_t i = lo; i < hi; i++)
+        found += tree.lookup(keys[i]) == (uint64_t)keys[i];
+    return found;
+}
+
+int main(int argc, char ** argv) {
+    string opt_prefix = "/mnt/pmem/pools.pool";
+    uint64_t opt_keys = 1000000;
+
+    static const char * optstr = "f:n:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'f':
+            opt_prefix = string(optarg);
+            break;
+        case 'n':
+            opt_keys = std::max(atol(optarg), 100000L);
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -f: " << "Prefix of the two pools, removed before and after the run (default /mnt/pmem/pools.pool)" << endl;
+            cout << "\t -n: " << "Number of keys (default 1000000)" << endl;
+            exit(-1);
+        }
+    }
+
+    vector<string> pools = {opt_prefix + ".0", opt_prefix + ".1"};
+    for(auto & p : pools)
+        unlink(p.c_str());
+    // a pool holds about 21B of nodes per key, a record takes about 28B of them
+    uint64_t poolsize = opt_keys * 24;
+
+    vector<_key_t> keys(opt_keys);
+    for(uint64_t i = 0; i < opt_keys; i++)
+        keys[i] = (i + 1) * 1000;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+
+    uint64_t errors = 0;
+    size_t half = opt_keys / 2;
+    {
+        TLBtree tree(pools, poolsize);
+        for(auto k : keys)
+            tree.insert(k, k);
+
+        tlbtree_footprint_t fp = tree.footprint();
+        printf("%lu of %lu blocks used, pool 0 holds %lu\n", fp.used_blocks, fp.max_blocks, fp.max_blocks / 2);
+        if(fp.used_blocks <= fp.max_blocks / 2) {
+            printf("the tree fits in pool 0, nothing was allocated from pool 1\n");
+            errors++;
+        }
+
+        // nodes freed by merges go back to their own pools, and are reused
+        for(size_t i = 0; i < half; i++)
+            errors += !tree.remove(keys[i]);
+        for(size_t i = 0; i < half; i += 2)
+            tree.insert(keys[i], keys[i]);
+        uint64_t found = count_found(tree, keys, 0, opt_keys);
+        printf("before the restart: %lu of %lu keys found\n", found, opt_keys - half / 2);
+        errors += found != opt_keys - half / 2;
+    }
+    {
+        TLBtree tree(pools, poolsize);
+        uint64_t found = count_found(tree, keys, 0, opt_keys);
+        printf("after the restart:  %lu of %lu keys found\n", found, opt_keys - half / 2);
+        errors += found != opt_keys - half / 2;
+    }
+    for(auto & p : pools)
+        unlink(p.c_str());
+    return errors == 0 ? 0 : 1;
+}
@@ -34,6 +34,14 @@ int main(int argc, char ** argv) {
     if(argc > 1 && atoi(argv[1]) > 0) {
         num_threads = atoi(argv[1]);
     }
+    if(argc > 2 && !pmemu_configure(argv[2])) { // emulate PM on DRAM with a profile
+        cout << "unknown PM emulation profile " << argv[2] << endl;
+        exit(-1);
+    }
+    if(argc > 3 && !set_persist_domain(argv[3])) { // adr, eadr or auto, as main -e
+        cout << "unknown persistence domain " << argv[3] << endl;
+        exit(-1);
+    }
     // open the data file
     std::string filename = "/home/lyp/TLBtree/Concurrent/build/dataset.dat";
     std::ifstream fin(filename.c_str(), std::ios::binary);
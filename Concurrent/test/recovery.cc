@@ -0,0 +1,217 @@
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <omp.h>
+
+#include "tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef TLBtreeImpl<2, 2> tree_t;
+
+static const char * POOL_PATH = "/mnt/pmem/recovery.pool";
+static const int BATCH = 8192;          // operations per throughput sample after a restart
+static const double FULL_SPEED = 0.9;   // a batch at this fraction of the reference is at full speed
+
+int opt_threads = 4;
+int opt_insert = 5;         // percent of inserts after a restart, they trigger the rebuilds
+double opt_budget = 10;     // seconds to wait for full speed after a restart
+
+struct restart_t {
+    double open_ms;         // construction of TLBtreeImpl
+    double full_ms;         // from the start of construction to the first full speed batch, < 0 if never
+    double rebuild_ms;      // rebuilds run in this restart
+    double tput;            // the throughput of the last batches, Mops/s
+};
+
+vector<_key_t> gen_keys(uint64_t cnt) { // distinct keys in random order, as datagen does
+    vector<_key_t> keys(cnt);
+    uint64_t step = MAX_KEY / cnt;
+    for(uint64_t i = 0; i < cnt; i++)
+        keys[i] = i * step + 1;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(10007));
+    return keys;
+}
+
+uint64_t pool_size(uint64_t cnt) {
+    return 256UL * MILLION + cnt * 96;
+}
+
+/*
+ *  Fill a new pool in a child process. The pool image right after the fill is copied to
+ *  crash_path before the tree is shut down, which is the state a crash leaves behind, and the
+ *  image after the shutdown to clean_path, from which every clean restart starts.
+ *  return the number of sub-index roots
+ */
+uint64_t fill(const vector<_key_t> & keys, const string & crash_path, const string & clean_path) {
+    int fds[2];
+    if(pipe(fds) != 0) exit(-1);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        unlink(POOL_PATH);
+        tree_t * tree = new tree_t(POOL_PATH, false, pool_size(keys.size()));
+        #pragma omp parallel for schedule(static) num_threads(opt_threads)
+        for(uint64_t i = 0; i < keys.size(); i++)
+            tree->insert(keys[i], (uint64_t)keys[i]);
+
+        tlbtree_stats_t st = tree->stats(); // waits for a running rebuild
+        uint64_t subroots = std::llround(st.uptree_leaf_fill * st.uptree_leaf_cnt * fixtree::LEAF_CARD) + st.mutable_size;
+        std::filesystem::copy_file(POOL_PATH, crash_path, std::filesystem::copy_options::overwrite_existing);
+
+        delete tree; // a clean shutdown
+        std::filesystem::copy_file(POOL_PATH, clean_path, std::filesystem::copy_options::overwrite_existing);
+        if(write(fds[1], &subroots, sizeof(subroots)) != sizeof(subroots)) _exit(-1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    uint64_t subroots = 0;
+    if(read(fds[0], &subroots, sizeof(subroots)) != sizeof(subroots)) {
+        cout << "failed to fill the pool" << endl;
+        exit(-1);
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return subroots;
+}
+
+/*
+ *  Open the pool and replay lookups (and some inserts) in batches, until a batch runs at
+ *  FULL_SPEED of ref_tput, or for ref_batches batches when ref_tput is 0
+ */
+restart_t restart(const string & path, const vector<_key_t> & keys, double ref_tput, int ref_batches) {
+    restart_t r = {0, -1, 0, 0};
+    std::mt19937_64 gen(getRandom());
+
+    double start = seconds();
+    tree_t * tree = new tree_t(path, true, pool_size(keys.size()));
+    r.open_ms = (seconds() - start) * 1e3;
+
+    vector<double> tputs;
+    for(int b = 0; ; b++) {
+        double batch_start = seconds();
+        for(int i = 0; i < BATCH; i++) {
+            _key_t k = keys[gen() % keys.size()];
+            if((int)(gen() % 100) < opt_insert) {
+                tree->insert(k + 1 + gen() % 0xff, k);
+            } else {
+                uint64_t v;
+                tree->find(k, v);
+            }
+        }
+        double now = seconds();
+        double tput = BATCH / (now - batch_start) / 1e6;
+        tputs.push_back(tput);
+
+        if(ref_tput > 0 && r.full_ms < 0 && tput >= FULL_SPEED * ref_tput)
+            r.full_ms = (batch_start - start) * 1e3;
+        if(ref_tput > 0 && (r.full_ms >= 0 || now - start > opt_budget)) break;
+        if(ref_tput == 0 && b + 1 == ref_batches) break;
+    }
+
+    // the median of the last half of the batches
+    vector<double> tail(tputs.begin() + tputs.size() / 2, tputs.end());
+    std::sort(tail.begin(), tail.end());
+    r.tput = tail[tail.size() / 2];
+
+    tlbtree_stats_t after = tree->stats(); // waits for a running rebuild, counted since the open
+    r.rebuild_ms = (after.rebuild_fast_sec + after.rebuild_recover_sec) * 1e3;
+    delete tree;
+    return r;
+}
+
+int main(int argc, char ** argv) {
+    string opt_sizes = "1,2,4";
+
+    static const char * optstr = "n:t:i:b:m:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'n':
+            opt_sizes = string(optarg);
+            break;
+        case 't':
+            opt_threads = std::max(atoi(optarg), 1);
+            break;
+        case 'i':
+            opt_insert = std::min(std::max(atoi(optarg), 0), 100);
+            break;
+        case 'b':
+            opt_budget = atof(optarg);
+            break;
+        case 'm':
+            if(!pmemu_configure(optarg)) {
+                cout << "unknown PM emulation profile " << optarg << endl;
+                exit(-1);
+            }
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -n: " << "Pool sizes to test, millions of keys, comma separated (default 1,2,4)" << endl;
+            cout << "\t -t: " << "Threads to fill the pool (default 4)" << endl;
+            cout << "\t -i: " << "Percent of inserts after a restart (default 5)" << endl;
+            cout << "\t -b: " << "Seconds to wait for full speed after a restart (default 10)" << endl;
+            cout << "\t -m: " << "Emulate PM latency and bandwidth on DRAM: optane100, optane100-1dimm, optane200" << endl;
+            exit(-1);
+        }
+    }
+
+    string crash_path = string(POOL_PATH) + ".crash";
+    string clean_path = string(POOL_PATH) + ".clean";
+    // a restart inserts and rebuilds, so each clean one reopens the image the fill shut down
+    auto restore_clean = [&]() {
+        std::filesystem::copy_file(clean_path, POOL_PATH, std::filesystem::copy_options::overwrite_existing);
+    };
+    vector<string> rows;
+    for(size_t pos = 0; pos <= opt_sizes.size(); ) {
+        size_t comma = std::min(opt_sizes.find(',', pos), opt_sizes.size());
+        uint64_t cnt = atof(opt_sizes.substr(pos, comma - pos).c_str()) * MILLION;
+        pos = comma + 1;
+        if(cnt == 0) continue;
+
+        vector<_key_t> keys = gen_keys(cnt);
+        uint64_t subroots = fill(keys, crash_path, clean_path);
+
+        // the clean restart also measures the reference throughput
+        restore_clean();
+        restart_t clean = restart(POOL_PATH, keys, 0, 64);
+        clean.full_ms = -1;
+        restore_clean();
+        restart_t again = restart(POOL_PATH, keys, clean.tput, 0);
+        clean.full_ms = again.full_ms;
+        restart_t crash = restart(crash_path, keys, clean.tput, 0);
+
+        char row[256];
+        snprintf(row, sizeof(row), "%8.1fM %10lu %10.2f %10.2f %10.2f %10.2f %10.2f %9.3f", cnt / (double)MILLION, subroots,
+                    again.open_ms, clean.full_ms, crash.open_ms, crash.full_ms, crash.rebuild_ms, clean.tput);
+        rows.push_back(row);
+        cout << row << endl;
+
+        unlink(POOL_PATH);
+        unlink(crash_path.c_str());
+        unlink(clean_path.c_str());
+    }
+
+    cout << "=========RECOVERY (ms, full speed is " << FULL_SPEED * 100 << "% of the clean Mops/s, -1 if not reached)=========" << endl;
+    printf("%9s %10s %10s %10s %10s %10s %10s %9s\n", "keys", "subroots", "clean open", "clean full",
+                "crash open", "crash full", "rebuild", "Mops/s");
+    for(auto & r : rows)
+        cout << r << endl;
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*  sharded.cc - routing, rebalance and stray purging of ShardedTLBtree checked against a std::map
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+
+#include "sharded_tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::map<_key_t, uint64_t> RefMap;
+
+static const int SHARDS = 4;
+static const int SCAN_LEN = 300;
+
+vector<shard_config_t> configs(const string & prefix) {
+    vector<shard_config_t> cfgs;
+    for(int s = 0; s < SHARDS; s++)
+        cfgs.emplace_back(prefix + "." + std::to_string(s));
+    return cfgs;
+}
+
+void remove_pools(const string & prefix) {
+    for(auto & c : configs(prefix))
+        unlink(c.path.c_str());
+    unlink((prefix + ".0.splits").c_str());
+}
+
+// the records of shard s, read from the shard itself rather than through the routing
+vector<Record> shard_records(ShardedTLBtree & tree, int s) {
+    vector<Record> out;
+    Record buf[SCAN_LEN];
+    _key_t start = MIN_KEY;
+    while(true) {
+        int n = tree.shard(s)->scan(start, SCAN_LEN, buf);
+        for(int i = 0; i < n; i++) {
+            if(!out.empty() && buf[i].key <= out.back().key) continue; // the last key of the previous batch
+            out.push_back(buf[i]);
+        }
+        if(n < SCAN_LEN) break;
+        start = buf[n - 1].key;
+    }
+    return out;
+}
+
+/*
+ *  every record is found where shard_of() routes it and nowhere else, and lookups, scans that
+ *  cross the shards, range scans and batch lookups agree with the reference
+ *  return the number of errors
+ */
+uint64_t check(ShardedTLBtree & tree, const RefMap & ref, const char * phase) {
+    uint64_t misrouted = 0, wrong = 0;
+    size_t total = 0;
+    for(int s = 0; s < tree.shard_cnt(); s++) {
+        for(auto & r : shard_records(tree, s)) {
+            total++;
+            misrouted += tree.shard_of(r.key) != s || ref.count(r.key) == 0;
+        }
+    }
+    misrouted += total != ref.size();
+
+    for(auto & kv : ref)
+        wrong += tree.lookup(kv.first) != kv.second;
+
+    std::mt19937_64 gen(7);
+    Record out[SCAN_LEN];
+    for(int i = 0; i < 1000; i++) {
+        _key_t start = gen() % MAX_KEY;
+        int len = 1 + gen() % SCAN_LEN;
+        int n = tree.scan(start, len, out);
+        auto it = ref.lower_bound(start);
+        int q = 0;
+        for(; q < len && it != ref.end(); q++, ++it)
+            wrong += q >= n || out[q].key != it->first;
+        wrong += n != q;
+    }
+
+    vector<Record> range;
+    _key_t lo = MAX_KEY / 8, hi = MAX_KEY / 8 * 7;
+    tree.scan_range(lo, hi, range);
+    auto it = ref.lower_bound(lo), stop = ref.lower_bound(hi);
+    wrong += range.size() != (size_t)std::distance(it, stop);
+    for(size_t q = 0; q < range.size() && it != stop; q++, ++it)
+        wrong += range[q].key != it->first;
+
+    vector<_key_t> keys;
+    for(auto & kv : ref)
+        keys.push_back(kv.first);
+    keys.push_back(1); // not in the tree
+    vector<uint64_t> vals;
+    tree.lookup_batch(keys, vals);
+    for(size_t i = 0; i < keys.size(); i++)
+        wrong += vals[i] != (i + 1 < keys.size() ? ref.at(keys[i]) : 0);
+
+    printf("%-18s: %lu records, %lu misrouted, %lu wrong results\n", phase, total, misrouted, wrong);
+    return misrouted + wrong;
+}
+
+int main(int argc, char ** argv) {
+    string opt_prefix = "/mnt/pmem/sharded.pool";
+    uint64_t opt_keys = 200000;
+
+    static const char * optstr = "f:n:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'f':
+            opt_prefix = string(optarg);
+            break;
+        case 'n':
+            opt_keys = std::max(atol(optarg), 1024L);
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -f: " << "Prefix of the shard pools, removed before and after the run (default /mnt/pmem/sharded.pool)" << endl;
+            cout << "\t -n: " << "Number of keys (default 200000)" << endl;
+            exit(-1);
+        }
+    }
+
+    uint64_t poolsize = std::max(opt_keys * 4096, 1UL << 30);
+    uint64_t errors = 0;
+    RefMap ref;
+    std::mt19937_64 gen(1);
+    _key_t stray;
+    remove_pools(opt_prefix);
+    {
+        // split keys far below the keys, so that everything lands in the last shard
+        ShardedTLBtree tree(configs(opt_prefix), {100, 200, 300}, poolsize);
+        while(ref.size() < opt_keys / 2) {
+            _key_t k = 1000 + gen() % (MAX_KEY - 1000);
+            if(ref.emplace(k, k + 1).second) tree.insert(k, k + 1);
+        }
+        vector<Record> batch;
+        while(ref.size() < opt_keys) {
+            _key_t k = 1000 + gen() % (MAX_KEY - 1000);
+            if(ref.emplace(k, k + 1).second) batch.emplace_back(k, (char *)(k + 1));
+        }
+        tree.ingest(batch, SHARDS);
+        errors += check(tree, ref, "loaded");
+
+        tree.rebalance(tree.even_splits());
+        errors += check(tree, ref, "rebalanced");
+        for(int s = 0; s < tree.shard_cnt(); s++) {
+            size_t cnt = shard_records(tree, s).size();
+            if(cnt + 1 < ref.size() / SHARDS || cnt > ref.size() / SHARDS + 1) {
+                printf("shard %d holds %lu of %lu records after rebalancing\n", s, cnt, ref.size());
+                errors++;
+            }
+        }
+
+        int i = 0;
+        for(auto it = ref.begin(); it != ref.end(); ) {
+            if(i++ % 2 == 0) {
+                errors += !tree.remove(it->first);
+                it = ref.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        errors += check(tree, ref, "removed half");
+
+        // a copy outside the range of its shard, as an interrupted rebalance leaves it
+        stray = ref.rbegin()->first;
+        tree.shard(0)->insert(stray, 12345);
+    }
+    {
+        ShardedTLBtree tree(configs(opt_prefix), {}, poolsize);
+        uint64_t val;
+        if(tree.shard(0)->find(stray, val)) {
+            printf("the stray record was not purged on open\n");
+            errors++;
+        }
+        errors += check(tree, ref, "reopened");
+    }
+    remove_pools(opt_prefix);
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+/*  single_index.cc - the Single variant of TLBtree behind the Index interface
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+
+    Built with the Single sources and headers into a shared library with hidden visibility,
+    so its fixtree, wotree256, galc and TLBtreeImpl do not clash with the Concurrent ones
+*/
+
+#include "tlbtree.h" // Single/include/tlbtree.h, by the include path of this target
+#include "index.h"
+
+class SingleIndex : public Index {
+private:
+    TLBtree tree_;
+
+public:
+    SingleIndex(const char * path): tree_(path) {}
+
+    void insert(int64_t key, uint64_t val) { tree_.insert(key, val); }
+    uint64_t lookup(int64_t key) { return tree_.lookup(key); }
+    bool update(int64_t key, uint64_t val) { return tree_.update(key, val); }
+    bool remove(int64_t key) { return tree_.remove(key); }
+    int scan(int64_t /* start */, int /* len */) { return -1; }
+
+    bool concurrent() const { return false; }
+};
+
+extern "C" __attribute__((visibility("default"))) Index * create_single_index(const char * path) {
+    return new SingleIndex(path);
+}
@@ -0,0 +1,172 @@
+/*  stress.cc - concurrent deletes, reinserts, finds and scans checked against the expected keys,
+    built with AddressSanitizer to catch the use of merged or unlinked nodes after they are freed
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <omp.h>
+
+#include "tlbtree.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+static const int SCAN_LEN = 64;
+
+/*
+ *  Each thread owns the keys i with i % threads == tid. It deletes most of them, reinserts some,
+ *  and looks up its own keys, whose state it knows, while the others merge and free the nodes
+ *  around them. At last they empty the lower three quarters of the key range, which compaction
+ *  unlinks and frees. Scans cross the keys of all threads, they must come out ascending and intact.
+ *  return the number of errors
+ */
+uint64_t run(const string & pool, int threads, uint64_t cnt, int rounds) {
+    unlink(pool.c_str());
+    TLBtree * tree = new TLBtree(pool, std::max(cnt * 4096, 1UL << 30));
+
+    vector<_key_t> keys(cnt);
+    for(uint64_t i = 0; i < cnt; i++)
+        keys[i] = (i + 1) * 1000;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(threads));
+
+    #pragma omp parallel for num_threads(threads)
+    for(uint64_t i = 0; i < cnt; i++)
+        tree->insert(keys[i], keys[i]);
+
+    vector<char> present(cnt, 1);
+    std::atomic<uint64_t> wrong(0), scan_wrong(0);
+    #pragma omp parallel num_threads(threads)
+    {
+        int tid = omp_get_thread_num();
+        std::mt19937_64 gen(tid + 1);
+        Record buf[SCAN_LEN];
+        for(int r = 0; r < rounds; r++) {
+            for(uint64_t i = tid; i < cnt; i += threads) { // delete most
+                if(gen() % 10 < 8 && present[i]) {
+                    tree->remove(keys[i]);
+                    present[i] = 0;
+                }
+
+                uint64_t j = tid + threads * (gen() % (cnt / threads));
+                uint64_t v = tree->lookup(keys[j]);
+                if((v != 0) != (bool)present[j] || (v != 0 && v != (uint64_t)keys[j]))
+                    wrong++;
+
+                if(gen() % 64 == 0) {
+                    int n = tree->scan(gen() % (cnt * 1000), SCAN_LEN, buf);
+                    for(int q = 0; q < n; q++) {
+                        if((q > 0 && buf[q].key <= buf[q - 1].key) || (uint64_t)buf[q].val != (uint64_t)buf[q].key)
+                            scan_wrong++;
+                    }
+                }
+            }
+            for(uint64_t i = tid; i < cnt; i += threads) { // reinsert half
+                if(!present[i] && gen() % 2) {
+                    tree->insert(keys[i], keys[i]);
+                    present[i] = 1;
+                }
+            }
+        }
+
+        // then empty the lower three quarters of the key range, whose sub-index trees are compacted away
+        #pragma omp barrier
+        for(uint64_t i = tid; i < cnt; i += threads) {
+            if(keys[i] <= (_key_t)cnt * 750 && present[i]) {
+                tree->remove(keys[i]);
+                present[i] = 0;
+            }
+            uint64_t j = tid + threads * (gen() % (cnt / threads));
+            uint64_t v = tree->lookup(keys[j]);
+            if((v != 0) != (bool)present[j] || (v != 0 && v != (uint64_t)keys[j]))
+                wrong++;
+        }
+    }
+
+    uint64_t missing = 0, expected = 0;
+    for(uint64_t i = 0; i < cnt; i++) {
+        uint64_t v = tree->lookup(keys[i]);
+        missing += (v != 0) != (bool)present[i];
+        expected += present[i];
+    }
+
+    // and one scan of the whole tree
+    uint64_t scanned = 0;
+    Record buf[SCAN_LEN];
+    _key_t start = MIN_KEY, last = MIN_KEY;
+    while(true) {
+        int n = tree->scan(start, SCAN_LEN, buf);
+        for(int q = 0; q < n; q++) {
+            if(q == 0 && start != MIN_KEY && buf[q].key == start) continue; // the last key of the previous batch
+            if(scanned > 0 && buf[q].key <= last) scan_wrong++;
+            last = buf[q].key;
+            scanned++;
+        }
+        if(n < SCAN_LEN) break;
+        start = last;
+    }
+    missing += scanned > expected ? scanned - expected : expected - scanned;
+
+    tlbtree_stats_t st = tree->stats();
+    printf("%3d threads: %lu wrong lookups, %lu wrong scans, %lu missing, %lu node merges, %lu compactions\n",
+            threads, (uint64_t)wrong, (uint64_t)scan_wrong, missing, st.node_merges, st.rebuild_compact_cnt);
+    delete tree;
+    unlink(pool.c_str());
+    return wrong + scan_wrong + missing;
+}
+
+int main(int argc, char ** argv) {
+    string opt_pool = "/mnt/pmem/stress.pool";
+    string opt_threads = "4,8,16";
+    uint64_t opt_keys = 200000;
+    int opt_rounds = 3;
+
+    static const char * optstr = "f:t:n:r:h";
+    opterr = 0;
+    char opt;
+    while((opt = getopt(argc, argv, optstr)) != -1) {
+        switch(opt) {
+        case 'f':
+            opt_pool = string(optarg);
+            break;
+        case 't':
+            opt_threads = string(optarg);
+            break;
+        case 'n':
+            opt_keys = std::max(atol(optarg), 1024L);
+            break;
+        case 'r':
+            opt_rounds = std::max(atoi(optarg), 1);
+            break;
+        case '?':
+        case 'h':
+        default:
+            cout << "USAGE: "<< argv[0] << "[option]" << endl;
+            cout << "\t -h: " << "Print the USAGE" << endl;
+            cout << "\t -f: " << "The pool file, removed before and after each run (default /mnt/pmem/stress.pool)" << endl;
+            cout << "\t -t: " << "Thread counts to run with, comma separated (default 4,8,16)" << endl;
+            cout << "\t -n: " << "Number of keys (default 200000)" << endl;
+            cout << "\t -r: " << "Rounds of deletes and reinserts (default 3)" << endl;
+            exit(-1);
+        }
+    }
+
+    uint64_t errors = 0;
+    for(size_t pos = 0; pos <= opt_threads.size(); ) {
+        size_t comma = std::min(opt_threads.find(',', pos), opt_threads.size());
+        int threads = atoi(opt_threads.substr(pos, comma - pos).c_str());
+        pos = comma + 1;
+        if(threads > 0) errors += run(opt_pool, threads, opt_keys, opt_rounds);
+    }
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/*  workload.h - the binary workload file shared by datagen and main
+    Copyright(c) 2020 Luo Yongping. THIS SOFTWARE COMES WITH NO WARRANTIES,
+    USE AT YOUR OWN RISK!
+*/
+
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+/*
+    Binary workload file:
+        a 16B header followed by fixed 16B QueryType records, so the file can be mapped and
+        handed to the threads as is. Each thread replays one contiguous slice of it.
+*/
+struct workload_header_t {
+    char magic[8];      // WORKLOAD_MAGIC
+    uint64_t count;     // the number of records
+};
+
+static const char WORKLOAD_MAGIC[8] = {'T', 'L', 'B', 'W', 'L', 'D', '0', '1'};
+
+static_assert(sizeof(QueryType) == 16, "QueryType is the on-disk record");
+
+inline bool write_workload(const char * path, const QueryType * querys, uint64_t count) {
+    FILE * fp = fopen(path, "wb");
+    if(fp == NULL) return false;
+
+    workload_header_t hdr;
+    memcpy(hdr.magic, WORKLOAD_MAGIC, sizeof(hdr.magic));
+    hdr.count = count;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(querys, sizeof(QueryType), count, fp) == count;
+    return fclose(fp) == 0 && ok;
+}
+
+class WorkloadFile {
+private:
+    void * map_;
+    size_t map_len_;
+    const QueryType * querys_;
+    uint64_t count_;
+    std::vector<QueryType> parsed_; // for text workload files
+
+public:
+    WorkloadFile(): map_(NULL), map_len_(0), querys_(NULL), count_(0) {}
+
+    ~WorkloadFile() {
+        if(map_ != NULL) munmap(map_, map_len_);
+    }
+
+    WorkloadFile(const WorkloadFile &) = delete;
+    WorkloadFile & operator = (const WorkloadFile &) = delete;
+
+    /*
+     *  Map a binary workload file, or parse a text one ("op key [len]" per line)
+     *  return false if the file can not be read
+     */
+    bool open(const char * path) {
+        int fd = ::open(path, O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat st;
+        workload_header_t hdr;
+        bool binary = fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(hdr) && 
+                        pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && 
+                        memcmp(hdr.magic, WORKLOAD_MAGIC, sizeof(hdr.magic)) == 0;
+        if(!binary) {
+            close(fd);
+            return parse(path);
+        }
+        if((uint64_t)st.st_size < sizeof(hdr) + hdr.count * sizeof(QueryType)) { // truncated
+            close(fd);
+            return false;
+        }
+
+        // populate the page table now, so that the measured phase takes no page faults
+        map_len_ = st.st_size;
+        map_ = mmap(NULL, map_len_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+        if(map_ == MAP_FAILED) {
+            map_ = NULL;
+            return false;
+        }
+        querys_ = (const QueryType *)((char *)map_ + sizeof(hdr));
+        count_ = hdr.count;
+        return true;
+    }
+
+    const QueryType * data() const { return querys_; }
+    uint64_t size() const { return count_; }
+
+    // the contiguous slice [begin, end) replayed by thread tid of thread_cnt
+    static void slice(uint64_t count, int tid, int thread_cnt, uint64_t & begin, uint64_t & end) {
+        begin = count * tid / thread_cnt;
+        end = count * (tid + 1) / thread_cnt;
+    }
+
+private:
+    bool parse(const char * path) {
+        std::ifstream fin(path);
+        if(!fin) return false;
+
+        int op, len;
+        _key_t key;
+        while(fin >> op >> key) {
+            len = 0;
+            if(op == OperationType::SCAN) // scans carry their length
+                fin >> len;
+            parsed_.push_back({(OperationType)op, len, key});
+        }
+        querys_ = parsed_.data();
+        count_ = parsed_.size();
+        return true;
+    }
+};
+
+#endif // __WORKLOAD_H__
@@ -7,6 +7,7 @@
 
 #include <cstdint>
 #include <limits>
+#include <typeinfo>
 #include <sys/stat.h>
 
 #define LOADSCALE 8
@@ -7,6 +7,7 @@
 #define __FLUSH_H__
 
 #include <x86intrin.h>
+#include <cpuid.h>
 
 #include "common.h"
 
@@ -14,14 +15,37 @@ static inline void mfence() {
     asm volatile("sfence" ::: "memory");
 }
 
+enum FlushType {FLUSH_CLFLUSH = 0, FLUSH_CLFLUSHOPT, FLUSH_CLWB};
+
+// the write-back instruction selected at start-up, defined in tlbtree_impl.cc
+extern FlushType flush_type;
+
+inline FlushType detect_flush_type() { // pick the cheapest write-back instruction the CPU supports
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        if(ebx & bit_CLWB) return FLUSH_CLWB;
+        if(ebx & bit_CLFLUSHOPT) return FLUSH_CLFLUSHOPT;
+    }
+    return FLUSH_CLFLUSH;
+}
+
+inline const char * flush_name(FlushType t = flush_type) {
+    static const char * names[] = {"clflush", "clflushopt", "clwb"};
+    return names[t];
+}
+
 static inline void flush(void * ptr) {
-#ifdef CLWB
-    _mm_clwb(ptr);
-#elif defined(CLFLUSHOPT)
-    _mm_clflushopt(ptr);
-#else
-    _mm_clflush(ptr);
-#endif
+    switch(flush_type) {
+    case FLUSH_CLWB:
+        _mm_clwb(ptr);
+        break;
+    case FLUSH_CLFLUSHOPT:
+        _mm_clflushopt(ptr);
+        break;
+    default:
+        _mm_clflush(ptr);
+        break;
+    }
 }
 
 inline void clwb(void *data, int len) {
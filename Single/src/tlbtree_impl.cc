@@ -1,3 +1,4 @@
 #include "tlbtree_impl.h"
 
-PMAllocator * galc;
\ No newline at end of file
+PMAllocator * galc;
+FlushType flush_type = detect_flush_type();
@@ -17,7 +17,6 @@ using std::ifstream;
 typedef double mytime_t;
 
 _key_t *keys;
-PMAllocator * galc;
 
 template <typename BTreeType>
 void preload(BTreeType &tree, uint64_t load_size, ifstream & fin) {